@@ -0,0 +1,46 @@
+#!/bin/bash
+# Compile throughput. Runs the compiler with --stats over every shape from
+# bench/generate.sh at each size and prints lines/sec for each phase, one
+# row per program. Usage: bench/compile.sh [compiler] [sizes...]
+PARSE=${1:-./parse}
+shift
+SIZES=${*:-1000 5000 20000}
+SHAPES="globals functions statements expressions init scopes"
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+printf "%-12s %8s %8s %12s %12s %12s %12s %12s %8s\n" \
+       shape n lines parse resolve typecheck codegen total peak_kb
+
+for shape in $SHAPES; do
+    for n in $SIZES; do
+        "$DIR/generate.sh" "$shape" "$n" > "$TMP/prog.bm"
+        if ! "$PARSE" "$TMP/prog.bm" -o /dev/null --stats 2> "$TMP/stats.json"; then
+            echo "$shape $n: compile failed" >&2
+            continue
+        fi
+
+        # --stats puts each phase on a line of its own.
+        awk -v shape="$shape" -v n="$n" -v lines="$(wc -l < "$TMP/prog.bm")" '
+            function field(key,    rest) {
+                rest = substr($0, index($0, "\"" key "\": ") + length(key) + 4);
+                return rest + 0;
+            }
+            function rate(ms) {
+                return ms > 0 ? sprintf("%.0f", lines / (ms / 1000)) : "-";
+            }
+            /"name": / {
+                name = substr($0, index($0, "\"name\": \"") + 9);
+                name = substr(name, 1, index(name, "\"") - 1);
+                ms[name] = field("wall_ms");
+                if(name == "total")
+                    peak = field("peak_rss_kb");
+            }
+            END {
+                printf "%-12s %8d %8d %12s %12s %12s %12s %12s %8d\n", shape, n, lines,
+                       rate(ms["parse"]), rate(ms["resolve"]), rate(ms["typecheck"]),
+                       rate(ms["codegen"]), rate(ms["total"]), peak;
+            }' "$TMP/stats.json"
+    done
+done
@@ -0,0 +1,93 @@
+#!/bin/bash
+# Writes a synthetic B-Minor program of the given shape and size to stdout,
+# for measuring how the compiler scales. Every shape compiles cleanly and
+# has a main, so the output can also be assembled and run.
+# Usage: bench/generate.sh SHAPE [N]
+#
+#   globals      N integer globals, summed by main
+#   functions    N two-argument functions, each called once from main
+#   statements   one function with N assignments and ifs
+#   expressions  N operands spread over balanced trees of 256 leaves each
+#   init         N array elements in init lists of 1000 (the init list
+#                grammar is right recursive, so one list stays bounded)
+#   scopes       N blocks nested 32 deep, each declaring its own local
+SHAPE=$1
+N=${2:-10000}
+
+case "$SHAPE" in
+    globals|functions|statements|expressions|init|scopes) ;;
+    *)
+        echo "usage: $0 globals|functions|statements|expressions|init|scopes [N]" >&2
+        exit 1
+        ;;
+esac
+
+awk -v shape="$SHAPE" -v n="$N" '
+# A balanced tree over operands v[lo..hi), alternating operators by depth.
+function tree(lo, hi, depth,    mid) {
+    if(hi - lo == 1)
+        return "v" (lo % 8);
+    mid = int((lo + hi) / 2);
+    return "(" tree(lo, mid, depth + 1) (depth % 3 == 0 ? " + " : depth % 3 == 1 ? " - " : " * ") tree(mid, hi, depth + 1) ")";
+}
+
+function locals(    i) {
+    for(i = 0; i < 8; i++)
+        printf "    v%d: integer = %d;\n", i, i + 1;
+}
+
+BEGIN {
+    if(shape == "globals") {
+        for(i = 0; i < n; i++)
+            printf "g%d: integer = %d;\n", i, i % 7;
+        printf "main: function integer () = {\n    s: integer = 0;\n";
+        for(i = 0; i < n; i++)
+            printf "    s = s + g%d;\n", i;
+        printf "    return s;\n}\n";
+    }
+    else if(shape == "functions") {
+        for(i = 0; i < n; i++)
+            printf "f%d: function integer (a: integer, b: integer) = {\n    return a * b + %d;\n}\n", i, i % 7;
+        printf "main: function integer () = {\n    s: integer = 0;\n";
+        for(i = 0; i < n; i++)
+            printf "    s = f%d(s %% 13, %d);\n", i, i % 5;
+        printf "    return s;\n}\n";
+    }
+    else if(shape == "statements") {
+        printf "main: function integer () = {\n    s: integer = 0;\n";
+        for(i = 0; i < n; i++) {
+            if(i % 4 == 3)
+                printf "    if(s > 100) { s = s - 100; }\n";
+            else
+                printf "    s = s + %d;\n", i % 7;
+        }
+        printf "    return s;\n}\n";
+    }
+    else if(shape == "expressions") {
+        printf "main: function integer () = {\n    s: integer = 0;\n";
+        locals();
+        for(i = 0; i < n; i += 256)
+            printf "    s = s + %s;\n", tree(i, i + 256 < n ? i + 256 : n, 0);
+        printf "    return s;\n}\n";
+    }
+    else if(shape == "init") {
+        for(a = 0; a * 1000 < n; a++) {
+            size = n - a * 1000 < 1000 ? n - a * 1000 : 1000;
+            printf "a%d: array [%d] integer = {", a, size;
+            for(i = 0; i < size; i++)
+                printf "%s%s%d", i ? "," : "", i % 16 ? " " : "\n    ", i % 97;
+            printf "\n};\n";
+        }
+        printf "main: function integer () = {\n    return a0[0];\n}\n";
+    }
+    else if(shape == "scopes") {
+        printf "main: function integer () = {\n    s: integer = 0;\n";
+        for(i = 0; i < n; i += 32) {
+            for(d = 0; d < 32 && i + d < n; d++)
+                printf "%*s{ x%d: integer = s + %d; s = x%d;\n", 4 + d, "", d, d % 7, d;
+            for(d--; d >= 0; d--)
+                printf "%*s}\n", 4 + d, "";
+        }
+        printf "    return s;\n}\n";
+    }
+}'
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Name resolution on a program with many globals. Generates N globals (50000
+# by default) and N/100 functions that each read 100 of them, then times the
+# compiler on it. Usage: bench/globals.sh [N] [compiler]
+N=${1:-50000}
+PARSE=${2:-./parse}
+SRC=$(mktemp --suffix=.bm)
+trap 'rm -f "$SRC"' EXIT
+
+awk -v n="$N" 'BEGIN {
+    for(i = 0; i < n; i++)
+        printf "g%d: integer = %d;\n", i, i % 7;
+    for(f = 0; f * 100 < n; f++) {
+        printf "f%d: function integer () = {\n    s: integer = 0;\n", f;
+        for(i = f * 100; i < n && i < (f + 1) * 100; i++)
+            printf "    s = s + g%d;\n", i;
+        printf "    return s;\n}\n";
+    }
+    printf "main: function integer () = {\n    return f0();\n}\n";
+}' > "$SRC"
+
+echo "$N globals, $(wc -l < "$SRC") lines"
+time "$PARSE" "$SRC" -o /dev/null
@@ -0,0 +1,73 @@
+/*
+ * Microbenchmark for hash_table. Inserts N keys, looks each one up by the
+ * inserted pointer and by an equal copy, then looks up N/10 missing keys.
+ * Built by bench/hash_table.sh against both the old and new table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hash_table.h"
+
+int STRMAX = 128;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char** make_keys(int n, const char* prefix)
+{
+    char** keys = malloc(sizeof(char*) * n);
+    char buffer[32];
+    for(int i = 0; i < n; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%s%d", prefix, i);
+        keys[i] = strdup(buffer);
+    }
+    return keys;
+}
+
+static void report(const char* phase, int count, double start)
+{
+    printf("%-14s %10.1f ns/op\n", phase, (now() - start) * 1e9 / count);
+}
+
+int main(int argc, char* argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 20000;
+    char** keys = make_keys(n, "g");
+    char** copies = make_keys(n, "g");
+    char** missing = make_keys(n / 10, "m");
+    long found = 0;
+
+    struct hash_table* ht = hash_table_create();
+
+    double start = now();
+    for(int i = 0; i < n; i++)
+        hash_table_insert(ht, keys[i], keys[i]);
+    report("insert", n, start);
+
+    start = now();
+    for(int i = 0; i < n; i++)
+        found += hash_table_at(ht, keys[i]) != NULL;
+    report("hit (same)", n, start);
+
+    start = now();
+    for(int i = 0; i < n; i++)
+        found += hash_table_at(ht, copies[i]) != NULL;
+    report("hit (copy)", n, start);
+
+    start = now();
+    for(int i = 0; i < n / 10; i++)
+        found += hash_table_at(ht, missing[i]) != NULL;
+    report("miss", n / 10, start);
+
+    hash_table_destroy(&ht);
+    if(found != 2L * n)
+        fprintf(stderr, "hash_table - found %ld of %d keys\n", found, 2 * n);
+
+    return 0;
+}
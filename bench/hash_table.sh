@@ -0,0 +1,22 @@
+#!/bin/bash
+# Compares the hash table in the working tree with the one at an older
+# revision (the first commit by default) using bench/hash_table.c.
+# Usage: bench/hash_table.sh [N] [revision]
+N=${1:-20000}
+ROOT=$(git -C "$(dirname "$0")" rev-parse --show-toplevel)
+OLD=${2:-$(git -C "$ROOT" rev-list --max-parents=0 HEAD)}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+mkdir -p "$TMP/old"
+git -C "$ROOT" show "$OLD:src/hash_table.c" > "$TMP/old/hash_table.c"
+git -C "$ROOT" show "$OLD:header/hash_table.h" > "$TMP/old/hash_table.h"
+
+CFLAGS="-O2 -I$ROOT/header"
+gcc $CFLAGS -I"$TMP/old" "$ROOT/bench/hash_table.c" "$TMP/old/hash_table.c" "$ROOT/src/vector.c" -o "$TMP/old/bench"
+gcc $CFLAGS "$ROOT/bench/hash_table.c" "$ROOT/src/hash_table.c" "$ROOT/src/vector.c" -o "$TMP/new"
+
+echo "old ($OLD), $N keys"
+"$TMP/old/bench" "$N"
+echo "new, $N keys"
+"$TMP/new" "$N"
@@ -0,0 +1,18 @@
+#include <stdio.h>
+
+static long data[100000];
+
+int main(void)
+{
+    long s = 0;
+
+    for(long i = 0; i < 100000; i++)
+        data[i] = i % 1000;
+
+    for(long r = 0; r < 200; r++)
+        for(long i = 0; i < 100000; i++)
+            s = (s + data[i] * r) % 1000003;
+
+    printf("%d\n", (int)s);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+static long a[90000];
+static long b[90000];
+static long c[90000];
+
+int main(void)
+{
+    long n = 300;
+    long t = 0;
+
+    for(long i = 0; i < n; i++)
+        for(long j = 0; j < n; j++)
+        {
+            a[i * n + j] = (i + j) % 10;
+            b[i * n + j] = (i * j + 1) % 10;
+        }
+
+    for(long i = 0; i < n; i++)
+        for(long j = 0; j < n; j++)
+        {
+            long s = 0;
+            for(long k = 0; k < n; k++)
+                s = s + a[i * n + k] * b[k * n + j];
+            c[i * n + j] = s;
+        }
+
+    for(long i = 0; i < n * n; i++)
+        t = (t + c[i]) % 1000003;
+
+    printf("%d\n", (int)t);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+// B-Minor's ^ gives the base itself for any exponent below two.
+static long power(long base, long exponent)
+{
+    long result = base;
+    while(exponent-- > 1)
+        result *= base;
+    return result;
+}
+
+int main(void)
+{
+    long s = 0;
+
+    for(long i = 0; i < 10000000; i++)
+        s = (s + power(i % 10, 5) + power(i % 7, i % 4)) % 1000003;
+
+    printf("%d\n", (int)s);
+    return 0;
+}
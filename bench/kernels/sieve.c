@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+static long composite[4000001];
+
+int main(void)
+{
+    long n = 4000000;
+    long count = 0;
+
+    for(long i = 2; i * i <= n; i++)
+        if(!composite[i])
+            for(long j = i * i; j <= n; j = j + i)
+                composite[j] = 1;
+
+    for(long i = 2; i <= n; i++)
+        if(!composite[i])
+            count++;
+
+    printf("%d\n", (int)count);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#include <stdio.h>
+
+int main(void)
+{
+    for(long i = 0; i < 300000; i++)
+        printf("line %d: %s%c", (int)i, "hello, world", '\n');
+
+    return 0;
+}
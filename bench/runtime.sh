@@ -0,0 +1,54 @@
+#!/bin/bash
+# Speed of the generated code. Builds each kernel in bench/kernels with the
+# compiler and gcc as build.sh does, builds its C twin at -O0 and -O2, checks
+# all three print the same thing and reports the best wall time of RUNS runs
+# (3 by default) with the B-Minor time as a multiple of each C time.
+# Usage: bench/runtime.sh [compiler] [kernel...]
+PARSE=${1:-./parse}
+shift
+ROOT=$(git -C "$(dirname "$0")" rev-parse --show-toplevel)
+KERNELS=${*:-$(cd "$ROOT/bench/kernels" && ls *.bm | sed 's/\.bm$//')}
+RUNS=${RUNS:-3}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# Best wall time in milliseconds over RUNS runs, output discarded.
+best() {
+    local best=
+    for((r = 0; r < RUNS; r++)); do
+        local start=$(date +%s%N)
+        "$1" > /dev/null
+        local ms=$((($(date +%s%N) - start) / 1000000))
+        if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+            best=$ms
+        fi
+    done
+    echo "$best"
+}
+
+ratio() {
+    awk -v a="$1" -v b="$2" 'BEGIN { if(b > 0) printf "%.2fx", a / b; else print "-" }'
+}
+
+printf "%-10s %10s %10s %10s %10s %10s\n" kernel bminor_ms c_O0_ms c_O2_ms vs_O0 vs_O2
+
+for k in $KERNELS; do
+    if ! "$PARSE" "$ROOT/bench/kernels/$k.bm" -o "$TMP/$k.s" ||
+       ! gcc -z noexecstack "$TMP/$k.s" "$ROOT/lib/print.c" "$ROOT/lib/string.c" -o "$TMP/$k.bm.bin" ||
+       ! gcc -O0 "$ROOT/bench/kernels/$k.c" -o "$TMP/$k.O0.bin" ||
+       ! gcc -O2 "$ROOT/bench/kernels/$k.c" -o "$TMP/$k.O2.bin"; then
+        echo "$k: build failed" >&2
+        continue
+    fi
+
+    expected=$("$TMP/$k.O0.bin" | cksum)
+    if [ "$("$TMP/$k.bm.bin" | cksum)" != "$expected" ] || [ "$("$TMP/$k.O2.bin" | cksum)" != "$expected" ]; then
+        echo "$k: output differs from the C version" >&2
+        continue
+    fi
+
+    bm=$(best "$TMP/$k.bm.bin")
+    o0=$(best "$TMP/$k.O0.bin")
+    o2=$(best "$TMP/$k.O2.bin")
+    printf "%-10s %10d %10d %10d %10s %10s\n" "$k" "$bm" "$o0" "$o2" "$(ratio "$bm" "$o0")" "$(ratio "$bm" "$o2")"
+done
@@ -0,0 +1,21 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdbool.h>
+#include <stddef.h>
+
+struct arena_block;
+
+// A point in the arena to roll back to; everything allocated after it goes.
+struct arena_mark
+{
+    struct arena_block* block;
+    size_t used;
+};
+
+void* arena_alloc(size_t size);
+bool arena_permanent(bool on);
+struct arena_mark arena_mark(void);
+void arena_release(struct arena_mark mark);
+void arena_destroy(void);
+
+#endif
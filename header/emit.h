@@ -0,0 +1,14 @@
+#ifndef EMIT_H
+#define EMIT_H
+
+void emit_open(int fd);
+void emit_close(void);
+void emit_flush(void);
+
+void emit_str(const char* s);
+void emit_char(char c);
+void emit_int(long value);
+void emit_label(int label);
+void emit_format(const char* format, ...);
+
+#endif
@@ -1,8 +1,9 @@
 #ifndef EXPR_H
 #define EXPR_H
+#include <stdio.h>
 #include "decl.h"
 #include "symbol.h"
-#include "register.h"
+#include "ir.h"
 
 typedef enum {EXPR_ASSIGN, EXPR_OR, EXPR_AND, EXPR_EQ, EXPR_NE, EXPR_LT, EXPR_LE, EXPR_INIT_LIST,
                 EXPR_GT, EXPR_GE, EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_MOD, EXPR_INC, EXPR_DEC,
@@ -19,6 +20,7 @@ struct expr
     const char* name;
     const char* string_literal;
     struct symbol* symbol;
+    struct type* type;
     int reg;
 };
 
@@ -29,11 +31,14 @@ struct expr* expr_create_boolean_literal( int b );
 struct expr* expr_create_char_literal( char c );
 struct expr* expr_create_string_literal( const char *str );
 struct expr* expr_copy(struct expr* expr);
+bool expr_has_call(struct expr* pExpr);
 
 void expr_resolve(struct expr* pExpr);
 struct type* expr_typecheck(struct expr* pExpr);
-void expr_codegen(struct expr* pExpr, struct decl *pDecl, struct scratch regs[], int offset, bool isGlobal);
+void expr_typecheck_report(FILE* out);
+void expr_codegen(struct expr* pExpr, struct decl *pDecl, struct ir_func* func, int offset, bool isGlobal);
+void expr_codegen_branch(struct expr* pExpr, struct decl* pDecl, struct ir_func* func, int onTrue, int onFalse);
 void expr_print(struct expr* expr);
-void expr_destroy(struct expr** ppExpr);
+void unclean_string(const char* input, char* output);
 
 #endif
@@ -0,0 +1,7 @@
+#ifndef FOLD_H
+#define FOLD_H
+#include "ir.h"
+
+void fold_function(struct ir_func* func);
+
+#endif
@@ -3,18 +3,26 @@
 #include <stdbool.h>
 #include "vector.h"
 
-typedef struct node Node;
-struct node
+/*
+ * Open addressing with linear probing over a flat array of slots. Keys are
+ * not copied, so they must outlive the table; callers pass interned or
+ * otherwise long lived strings. An empty slot has a NULL key and a removed
+ * one keeps its place in the probe chain as a tombstone. Neither holds a
+ * value.
+ */
+struct hash_slot
 {
-    char* key;
+    unsigned long hash;
+    const char* key;
     void* value;
 };
 
 struct hash_table
 {
     int size;
+    int used;
     int capacity;
-    Node** arr;
+    struct hash_slot* slots;
 };
 
 struct hash_table* hash_table_create(void);
@@ -0,0 +1,10 @@
+#ifndef INLINE_H
+#define INLINE_H
+#include <stdbool.h>
+#include "ir.h"
+
+void inline_function(struct ir_func* func);
+bool inline_register(struct ir_func* func);
+void inline_destroy(void);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef INSTR_H
+#define INSTR_H
+#include <stdbool.h>
+#include "register.h"
+
+typedef enum {INSTR_MOVQ, INSTR_MOVZBQ, INSTR_LEAQ, INSTR_ADDQ, INSTR_SUBQ, INSTR_IMULQ, INSTR_IMULQ_WIDE,
+              INSTR_IDIVQ, INSTR_CQTO, INSTR_XORQ, INSTR_ANDQ, INSTR_SHLQ, INSTR_SARQ, INSTR_SHRQ, INSTR_TESTQ, INSTR_CMPQ, INSTR_INCQ, INSTR_DECQ, INSTR_NEGQ, INSTR_PUSHQ, INSTR_POPQ, INSTR_CALL, INSTR_RET,
+              INSTR_JMP, INSTR_JE, INSTR_JNE, INSTR_JL, INSTR_JLE, INSTR_JG, INSTR_JGE,
+              INSTR_SETE, INSTR_SETNE, INSTR_SETL, INSTR_SETLE, INSTR_SETG, INSTR_SETGE,
+              INSTR_CMOVE, INSTR_CMOVNE, INSTR_CMOVL, INSTR_CMOVLE, INSTR_CMOVG, INSTR_CMOVGE,
+              INSTR_LABEL, INSTR_DIRECTIVE} instr_t;
+
+typedef enum {OPERAND_NONE, OPERAND_REG, OPERAND_IMM, OPERAND_MEM, OPERAND_LABEL, OPERAND_SYMBOL} operand_t;
+
+/*
+ * A single AT&T operand. Memory operands are disp(base, index, scale) where
+ * base/index are -1 when absent, and symbol replaces disp for name(%rip).
+ * A %rip base without a symbol addresses the .L label held in value.
+ * Register operands with a scale of 1 name the low byte of the register.
+ * INSTR_IMULQ_WIDE is the one operand IMULQ, %rdx:%rax = %rax * operand.
+ * SETcc and CMOVcc are declared in the same order as the Jcc they share a
+ * condition with.
+ */
+struct operand
+{
+    operand_t kind;
+    int reg;
+    int index;
+    int scale;
+    long value;
+    const char* symbol;
+};
+
+struct instr
+{
+    instr_t kind;
+    struct operand src;
+    struct operand dst;
+    char* text;
+};
+
+struct instr_list
+{
+    int size;
+    int capacity;
+    struct instr* arr;
+
+    int vreg_count;
+    int epilogue;
+};
+
+struct operand operand_none(void);
+struct operand operand_reg(int r);
+struct operand operand_reg8(int r);
+struct operand operand_imm(long value);
+struct operand operand_mem(int base, int index, int scale, long disp);
+struct operand operand_global(const char* symbol);
+struct operand operand_global_label(int label);
+struct operand operand_label(int label);
+struct operand operand_symbol(const char* symbol);
+
+struct instr_list* instr_list_create(void);
+int instr_list_vreg(struct instr_list* code);
+
+void instr_emit(struct instr_list* code, instr_t kind, struct operand src, struct operand dst);
+void instr_emit_directive(struct instr_list* code, const char* text);
+void instr_emit_call(struct instr_list* code, const char* name);
+void instr_list_append(struct instr_list* code, struct instr* pInstr);
+
+bool instr_list_has_call(struct instr_list* code);
+bool instr_is_jump(instr_t kind);
+instr_t instr_jump_negate(instr_t jump);
+int instr_operand_count(instr_t kind);
+
+void instr_list_print(struct instr_list* code);
+void instr_list_destroy(struct instr_list** ppCode);
+
+#endif
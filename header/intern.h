@@ -0,0 +1,7 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+const char* intern(const char* text, int length);
+void intern_destroy(void);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef IR_H
+#define IR_H
+#include <stdbool.h>
+#include "symbol.h"
+
+typedef enum {IR_CONST, IR_COPY, IR_PARAM, IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD, IR_EXP, IR_NEG,
+              IR_NOT, IR_EQ, IR_NE, IR_LT, IR_LE, IR_GT, IR_GE,
+              IR_LOAD, IR_STORE, IR_ADDR, IR_LOAD_ELEM, IR_STORE_ELEM, IR_LOAD_BYTE, IR_STRING,
+              IR_ARG, IR_CALL, IR_RET, IR_JMP, IR_BR, IR_BEQ, IR_BNE, IR_BLT, IR_BLE, IR_BGT, IR_BGE} ir_t;
+
+typedef enum {IR_NONE, IR_TEMP, IR_IMM} ir_value_t;
+
+struct ir_value
+{
+    ir_value_t kind;
+    int value;
+};
+
+/*
+ * dst = a op b. dst is -1 when nothing is written. symbol names the global or
+ * array for loads, stores and ADDR; name is the CALL target or STRING contents.
+ * JMP keeps its target in the block's succ[0]. The branches go to succ[0]
+ * when their condition holds and succ[1] otherwise: BR tests a != 0, BEQ
+ * through BGE compare a with b.
+ */
+struct ir_instr
+{
+    ir_t op;
+    int dst;
+    struct ir_value a;
+    struct ir_value b;
+    struct symbol* symbol;
+    const char* name;
+};
+
+struct ir_block
+{
+    int size;
+    int capacity;
+    struct ir_instr* arr;
+    int succ[2];
+    bool placed;
+};
+
+struct ir_func
+{
+    struct decl* decl;
+    int temp_count;
+
+    int block_count;
+    int block_capacity;
+    struct ir_block* blocks;
+    int current;
+
+    // Blocks in the order they were placed, which is the order they are emitted.
+    int* order;
+    int order_count;
+
+    int local_count;
+    int* locals;
+    int frame_slots;
+};
+
+struct ir_value ir_none(void);
+struct ir_value ir_imm(int value);
+struct ir_value ir_temp_value(int temp);
+
+struct ir_func* ir_func_create(struct decl* pDecl);
+int ir_temp(struct ir_func* func);
+int ir_local(struct ir_func* func, int which);
+int ir_block_create(struct ir_func* func);
+void ir_block_set(struct ir_func* func, int block);
+
+struct ir_instr* ir_emit(struct ir_func* func, ir_t op, int dst, struct ir_value a, struct ir_value b);
+void ir_jump(struct ir_func* func, int target);
+void ir_branch(struct ir_func* func, ir_t op, struct ir_value a, struct ir_value b, int onTrue, int onFalse);
+bool ir_block_terminated(struct ir_block* block);
+bool ir_is_terminator(ir_t op);
+bool ir_is_branch(ir_t op);
+ir_t ir_branch_op(ir_t compare);
+ir_t ir_compare_op(ir_t branch);
+
+void ir_print(struct ir_func* func, const char* pass);
+void ir_func_destroy(struct ir_func** pFunc);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef ISEL_H
+#define ISEL_H
+#include "instr.h"
+#include "ir.h"
+
+struct instr_list* isel_function(struct ir_func* func);
+
+#endif
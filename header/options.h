@@ -0,0 +1,17 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+#include <stdbool.h>
+
+struct options
+{
+    bool dump_ir;
+    bool peephole_stats;
+    bool typecheck_stats;
+    bool stats;
+    bool leaf_functions;
+    bool inline_functions;
+};
+
+extern struct options options;
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+#include <stdio.h>
+#include "instr.h"
+
+void peephole_function(struct instr_list* code);
+void peephole_report(FILE* out);
+
+#endif
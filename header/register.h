@@ -2,18 +2,23 @@
 #define REGISTER_H
 #include <stdbool.h>
 
-struct scratch
-{
-    int r;
-    bool in_use;
-    const char* name;
-};
+typedef enum {REG_RAX, REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_RBP, REG_RSP,
+              REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+              REG_RIP, REG_COUNT} reg_t;
 
-int scratch_alloc(struct scratch regs[]);
-void scratch_free(struct scratch regs[], int r);
-const char* scratch_name(struct scratch regs[], int r);
+// Registers numbered VREG_BASE and above are virtual and get mapped onto
+// physical registers (or stack slots) by register_allocate.
+#define VREG_BASE 32
+
+struct instr_list;
+
+bool register_is_virtual(int r);
+const char* register_name(int r);
+const char* register_name8(int r);
+
+int register_allocate(struct instr_list* code, int frameSlots, bool leaf);
+int register_callee_saved(struct instr_list* code, int regs[]);
 
 int label_create();
-char* label_name(int label);
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdio.h>
+
+/*
+ * Running totals bumped by the modules that own each kind of object. They
+ * are cheap enough to keep unconditionally; --stats snapshots them around
+ * every phase.
+ */
+struct stats
+{
+    long ast_nodes;
+    long symbols;
+    long labels;
+    long instructions;
+    long allocations;
+    long allocated_bytes;
+};
+
+extern struct stats stats;
+
+void stats_phase_begin(const char* name);
+void stats_phase_end(void);
+void stats_report(FILE* out);
+
+#endif
@@ -22,8 +22,7 @@ struct stmt* stmt_create(stmt_t kind, struct decl* decl, struct expr* init_expr,
 
 void stmt_resolve(struct stmt* pStmt);
 void stmt_typecheck(struct stmt* pStmt, struct symbol* symbol);
-void stmt_codegen(struct stmt* pStmt, struct decl *pDecl, struct scratch regs[], struct symbol* sym);
+void stmt_codegen(struct stmt* pStmt, struct decl *pDecl, struct ir_func* func, struct symbol* sym);
 void stmt_print(struct stmt* pStmt, int depth);
-void stmt_destroy(struct stmt** ppStmt);
 
 #endif
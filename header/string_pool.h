@@ -0,0 +1,8 @@
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+int string_pool_label(const char* literal);
+void string_pool_emit(void);
+void string_pool_destroy(void);
+
+#endif
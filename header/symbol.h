@@ -2,6 +2,8 @@
 #define SYMBOL_H
 #include "type.h"
 
+struct ir_func;
+
 typedef enum {SYMBOL_GLOBAL, SYMBOL_PARAM, SYMBOL_LOCAL} symbol_t;
 
 struct symbol
@@ -9,15 +11,16 @@ struct symbol
     symbol_t kind;
     int which;
     struct type* type;
-    char* name;
+    const char* name;
+    // Call sites naming this symbol, counted as they are resolved.
+    int calls;
 };
 
-struct symbol* symbol_create(symbol_t kind, struct type* type, char* name);
-const char* symbol_codegen(struct symbol* symbol);
+struct symbol* symbol_create(symbol_t kind, struct type* type, const char* name);
+int symbol_codegen(struct symbol* symbol, struct ir_func* func);
 struct symbol* symbol_copy(struct symbol* symbol);
 bool symbol_equal(struct symbol* a, struct symbol* b);
 void symbol_print(struct symbol* sym);
-void symbol_destroy(struct symbol** sym);
 
 void scope_enter(void);
 void scope_exit(void);
@@ -13,13 +13,12 @@ struct type
 };
 
 struct type* type_create(type_t kind, struct type* subtype, struct param_list* params, struct expr* value);
+struct type* type_array(struct type* subtype, int size);
 
 bool type_equals(struct type* a, struct type* b);
-struct type* type_copy(struct type* type);
+void type_table_destroy(void);
 
-void type_resolve(struct type* pType);
 void type_print(struct type* pType);
 const char* type_string(struct type* pType);
-void type_destroy(struct type** ppType);
 
 #endif
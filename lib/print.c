@@ -1,22 +1,147 @@
-#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Everything printed goes through one buffer that is written out when it
+ * fills, when the program exits and, if stdout is a terminal, at the end of
+ * every line so interactive output still shows up as it is printed.
+ */
+#define PRINT_BUFFER (64 * 1024)
+
+static char buffer[PRINT_BUFFER];
+static int used;
+static int terminal = -1;
+
+static void put(const char* s, int length);
+static void write_all(const char* s, int length);
+
+void printFlush(void)
+{
+    write_all(buffer, used);
+    used = 0;
+}
+
+// Programs that return from main leave through exit(), which runs this.
+__attribute__((destructor)) static void print_exit(void)
+{
+    printFlush();
+}
 
 void printBool(int b)
 {
-    printf("%s", b ? "true" : "false");
+    if(b)
+        put("true", 4);
+    else
+        put("false", 5);
 }
 
 void printChar(int c)
 {
-    printf("%c", c);
+    char ch = c;
+    put(&ch, 1);
 }
 
 void printInt(int i)
 {
-    printf("%d", i);
+    char digits[16];
+    char* p = digits + sizeof(digits);
+    unsigned int u = i < 0 ? 0u - (unsigned int)i : (unsigned int)i;
+
+    do
+    {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while(u);
+
+    if(i < 0)
+        *--p = '-';
+
+    put(p, digits + sizeof(digits) - p);
 }
 
 void printString(const char* s)
 {
-    printf("%s", s);
+    put(s, strlen(s));
 }
 
+/*
+ * A whole print statement. The format is text to copy with a directive for
+ * each value that follows: %d integer, %c char, %b boolean, %s string, and
+ * %% for a literal percent sign.
+ */
+void printList(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    const char* p;
+    while((p = strchr(format, '%')))
+    {
+        put(format, p - format);
+        switch(p[1])
+        {
+            case 'd':
+                printInt(va_arg(args, long));
+                break;
+            case 'c':
+                printChar(va_arg(args, long));
+                break;
+            case 'b':
+                printBool(va_arg(args, long));
+                break;
+            case 's':
+                printString(va_arg(args, const char*));
+                break;
+            case '\0':
+                va_end(args);
+                return;
+            default:
+                put(p + 1, 1);
+                break;
+        }
+        format = p + 2;
+    }
+    put(format, strlen(format));
+
+    va_end(args);
+}
+
+static void put(const char* s, int length)
+{
+    if(length > PRINT_BUFFER - used)
+    {
+        printFlush();
+        if(length > PRINT_BUFFER)
+        {
+            write_all(s, length);
+            return;
+        }
+    }
+
+    memcpy(buffer + used, s, length);
+    used += length;
+
+    if(terminal < 0)
+        terminal = isatty(STDOUT_FILENO);
+    if(terminal && memchr(s, '\n', length))
+        printFlush();
+}
+
+static void write_all(const char* s, int length)
+{
+    while(length > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, s, length);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return;
+        }
+
+        s += n;
+        length -= n;
+    }
+}
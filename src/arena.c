@@ -0,0 +1,143 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_BLOCK (64 * 1024)
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct arena_block
+{
+    struct arena_block* next;
+    size_t used;
+    size_t capacity;
+    max_align_t data[];
+};
+
+/*
+ * The AST, its symbols and params for the whole compilation unit are bump
+ * allocated here in parse order and released together by arena_destroy.
+ * blocks is the chain in use, newest first; blocks given back by
+ * arena_release wait in spare to be reused. Hash-consed types outlive any
+ * one function, so they come from the permanent chain, which arena_release
+ * never touches.
+ */
+static struct arena_block* blocks;
+static struct arena_block* spare;
+static struct arena_block* permanent_blocks;
+static bool permanent;
+
+static struct arena_block* arena_block(size_t size);
+
+/*
+ * Zeroed, suitably aligned memory that lives until the arena is destroyed
+ * or released past.
+ */
+void* arena_alloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    struct arena_block** chain = permanent ? &permanent_blocks : &blocks;
+    if(!*chain || (*chain)->capacity - (*chain)->used < size)
+    {
+        struct arena_block* block = arena_block(size);
+        if(!block)
+            return NULL;
+
+        block->next = *chain;
+        *chain = block;
+    }
+
+    void* p = (char*)(*chain)->data + (*chain)->used;
+    (*chain)->used += size;
+    memset(p, 0, size);
+
+    stats.allocations++;
+    stats.allocated_bytes += size;
+    return p;
+}
+
+/*
+ * Sends arena_alloc to the permanent chain while set, so code that builds
+ * long lived objects out of ordinary constructors keeps them past any
+ * sub-arena. Returns the previous setting to restore.
+ */
+bool arena_permanent(bool on)
+{
+    bool was = permanent;
+    permanent = on;
+    return was;
+}
+
+/*
+ * Marks the start of a sub-arena. Allocations made until the matching
+ * arena_release, such as the temporaries of one function, are dropped
+ * together without touching anything allocated before.
+ */
+struct arena_mark arena_mark(void)
+{
+    struct arena_mark mark = {blocks, blocks ? blocks->used : 0};
+    return mark;
+}
+
+void arena_release(struct arena_mark mark)
+{
+    while(blocks && blocks != mark.block)
+    {
+        struct arena_block* next = blocks->next;
+        blocks->next = spare;
+        spare = blocks;
+        blocks = next;
+    }
+
+    if(blocks)
+        blocks->used = mark.used;
+}
+
+void arena_destroy(void)
+{
+    arena_release((struct arena_mark){NULL, 0});
+
+    while(permanent_blocks)
+    {
+        struct arena_block* next = permanent_blocks->next;
+        free(permanent_blocks);
+        permanent_blocks = next;
+    }
+
+    while(spare)
+    {
+        struct arena_block* next = spare->next;
+        free(spare);
+        spare = next;
+    }
+}
+
+/*
+ * A block with room for at least size bytes, reusing a released one when it
+ * is big enough.
+ */
+static struct arena_block* arena_block(size_t size)
+{
+    if(spare && spare->capacity >= size)
+    {
+        struct arena_block* block = spare;
+        spare = spare->next;
+        block->used = 0;
+        return block;
+    }
+
+    size_t capacity = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+    struct arena_block* block = malloc(sizeof(struct arena_block) + capacity);
+    if(!block)
+    {
+        fprintf(stderr, "arena_block - Failed to allocate space for arena\n");
+        return NULL;
+    }
+
+    block->used = 0;
+    block->capacity = capacity;
+    return block;
+}
@@ -1,24 +1,41 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
 #include "decl.h"
+#include "emit.h"
 #include "expr.h"
+#include "fold.h"
+#include "inline.h"
+#include "instr.h"
+#include "ir.h"
+#include "isel.h"
+#include "options.h"
+#include "peephole.h"
+#include "string_pool.h"
 #include "param_list.h"
+#include "register.h"
+#include "stats.h"
 #include "stmt.h"
 #include "symbol.h"
 #include "type.h"
 
-static int pushLocalVarsToStack(struct decl* pDecl);
 static int  countDeclarations(struct stmt* pStmt);
-static void moveParamsToStack(struct param_list* pParams);
+static void moveParamsToLocals(struct param_list* pParams, struct ir_func* func);
+static bool useRedZone(struct instr_list* code, int slots);
 
-struct decl* decl_create(char* name, struct type* type, struct expr* value, struct stmt* code, struct decl* next)
+// Bytes below %rsp a leaf may use without moving it, per the SysV ABI.
+#define RED_ZONE 128
+
+struct decl* decl_create(const char* name, struct type* type, struct expr* value, struct stmt* code, struct decl* next)
 {
-    struct decl* pDecl = malloc(sizeof(struct decl));
+    struct decl* pDecl = arena_alloc(sizeof(struct decl));
     if(pDecl)
     {
+        stats.ast_nodes++;
         pDecl->name = name;
         pDecl->type = type;
+        pDecl->params = NULL;
         pDecl->value = value;
         pDecl->code = code;
         pDecl->symbol = NULL;
@@ -30,173 +47,218 @@ struct decl* decl_create(char* name, struct type* type, struct expr* value, stru
 
 void decl_resolve(struct decl* pDecl)
 {
-    if(!pDecl) return;
-
-    symbol_t kind = scope_level() > 1 ? SYMBOL_LOCAL : SYMBOL_GLOBAL;
-    if(pDecl->type->kind == TYPE_AUTO)
+    for(; pDecl; pDecl = pDecl->next)
     {
-        struct type* temp = expr_typecheck(pDecl->value);
-        type_destroy(&pDecl->type);
-        pDecl->type = temp;
-    }
+        symbol_t kind = scope_level() > 1 ? SYMBOL_LOCAL : SYMBOL_GLOBAL;
+        if(pDecl->type->kind == TYPE_AUTO)
+        {
+            pDecl->type = expr_typecheck(pDecl->value);
+        }
 
-    pDecl->symbol = symbol_create(kind, pDecl->type, pDecl->name);
-    scope_bind(pDecl->name, pDecl->symbol);
+        pDecl->symbol = symbol_create(kind, pDecl->type, pDecl->name);
+        scope_bind(pDecl->name, pDecl->symbol);
 
-    expr_resolve(pDecl->value);
+        expr_resolve(pDecl->value);
 
-    if(pDecl->code)
-    {
-        scope_enter();
-        param_list_resolve(pDecl->type->params);
-        stmt_resolve(pDecl->code);
-        scope_exit();
+        if(pDecl->code)
+        {
+            // The type is shared with every function of the same signature,
+            // so the params that get symbols here are the function's own copy.
+            pDecl->params = param_list_copy(pDecl->type->params);
+
+            scope_enter();
+            param_list_resolve(pDecl->params);
+            stmt_resolve(pDecl->code);
+            scope_exit();
+        }
     }
-
-    decl_resolve(pDecl->next);
 }
 
 void decl_typecheck(struct decl* pDecl)
 {
-    if(!pDecl) return;
-
-    if(pDecl->type->kind == TYPE_ARRAY)
+    for(; pDecl; pDecl = pDecl->next)
     {
-        if(pDecl->type->value == NULL)
+        if(pDecl->type->kind == TYPE_ARRAY)
         {
-            printf("type error: arrays must be declared with fixed size - ");
-            decl_print(pDecl);
+            if(pDecl->type->value == NULL)
+            {
+                printf("type error: arrays must be declared with fixed size - ");
+                decl_print(pDecl);
+            }
         }
-    }
 
-    if(pDecl->value)
-    {
-        struct type* t = expr_typecheck(pDecl->value);
-        if(pDecl->type->kind == TYPE_AUTO)
+        if(pDecl->value)
         {
-            type_destroy(&pDecl->type);
-            type_destroy(&pDecl->symbol->type);
-            pDecl->type = type_copy(t);
-            pDecl->symbol->type = type_copy(t);
+            struct type* t = expr_typecheck(pDecl->value);
+            if(pDecl->type->kind == TYPE_AUTO)
+            {
+                pDecl->type = t;
+                pDecl->symbol->type = t;
+            }
+            else if(!type_equals(t, pDecl->type))
+            {
+                printf("type error: cannot assign an expression of type ");
+                type_print(t); printf(" (");
+                expr_print(pDecl->value);
+                printf(") to a variable of type ");
+                type_print(pDecl->type); printf(" (%s)\n", pDecl->name);
+            }
         }
-        else if(!type_equals(t, pDecl->type))
+
+        if(pDecl->code)
         {
-            printf("type error: cannot assign an expression of type ");
-            type_print(t); printf(" (");
-            expr_print(pDecl->value);
-            printf(") to a variable of type ");
-            type_print(pDecl->type); printf(" (%s)\n", pDecl->name);
+            struct symbol* sym = scope_lookup(pDecl->name);
+            param_list_typecheck(pDecl->type->params, sym->type->params);
+            stmt_typecheck(pDecl->code, sym);
         }
-        type_destroy(&t);
-    }
-
-    if(pDecl->code)
-    {
-        struct symbol* sym = scope_lookup(pDecl->name);
-        param_list_typecheck(pDecl->type->params, sym->type->params);
-        stmt_typecheck(pDecl->code, sym);
     }
-
-    decl_typecheck(pDecl->next);
 }
 
-void decl_codegen(struct decl* pDecl, struct scratch regs[])
+void decl_codegen(struct decl* pDecl, struct ir_func* func)
 {
-    if(!pDecl) return;
-
-    if(pDecl->code)
+    for(; pDecl; pDecl = pDecl->next)
     {
-        printf("############################\n");
-        printf(".text\n");
-        printf("%s:\n", pDecl->name);
-
-        struct scratch funcRegs[] = {
-            {0, false, "%rbx"},
-            {1, false, "%r10"},
-            {2, false, "%r11"},
-            {3, false, "%r12"},
-            {4, false, "%r13"},
-            {5, false, "%r14"},
-            {6, false, "%r15"}
-        };
-
-        printf("PUSHQ %%rbp\n");
-        printf("MOVQ  %%rsp, %%rbp\n");
-
-        pushLocalVarsToStack(pDecl);
-
-        printf("PUSHQ %%rbx\n");
-        printf("PUSHQ %%r12\n");
-        printf("PUSHQ %%r13\n");
-        printf("PUSHQ %%r14\n");
-        printf("PUSHQ %%r15\n");
-
-        printf("\n############################\n\n");
-
-        stmt_codegen(pDecl->code, pDecl, funcRegs, pDecl->symbol);
-
-        printf("\n############################\n\n");
-        printf(".%s_epilouge:\n", pDecl->name);
-
-        printf("POPQ %%r15\n");
-        printf("POPQ %%r14\n");
-        printf("POPQ %%r13\n");
-        printf("POPQ %%r12\n");
-        printf("POPQ %%rbx\n");
-
-        printf("MOVQ %%rbp, %%rsp\n");
-        printf("POPQ %%rbp\n");
-        printf("RET\n");
-    }
-    else
-    {
-        if(pDecl->symbol->kind == SYMBOL_GLOBAL)
+        if(pDecl->code)
         {
-            const char* label;
-            switch(pDecl->type->kind)
+            emit_str("############################\n.text\n");
+            emit_str(pDecl->name);
+            emit_str(":\n");
+
+            // Anything lowering puts in the arena is only needed until the
+            // body is emitted, unless the inliner keeps the IR.
+            struct arena_mark mark = arena_mark();
+
+            struct ir_func* ir = ir_func_create(pDecl);
+            ir->frame_slots = countDeclarations(pDecl->code);
+
+            moveParamsToLocals(pDecl->params, ir);
+            stmt_codegen(pDecl->code, pDecl, ir, pDecl->symbol);
+            if(!ir_block_terminated(&ir->blocks[ir->current]))
+                ir_emit(ir, IR_RET, -1, ir_none(), ir_none());
+
+            if(options.dump_ir)
+                ir_print(ir, "lowering");
+
+            // Folding runs after inlining so it sees arguments substituted
+            // into the callees' bodies.
+            if(options.inline_functions)
+            {
+                inline_function(ir);
+                if(options.dump_ir)
+                    ir_print(ir, "inlining");
+            }
+
+            fold_function(ir);
+            if(options.dump_ir)
+                ir_print(ir, "folding");
+            bool kept = options.inline_functions && inline_register(ir);
+
+            struct instr_list* body = isel_function(ir);
+            bool leaf = options.leaf_functions && !instr_list_has_call(body);
+            int slots = register_allocate(body, ir->frame_slots, leaf);
+            peephole_function(body);
+
+            int saved[5];
+            int savedCount = register_callee_saved(body, saved);
+            bool frameless = leaf && useRedZone(body, slots);
+
+            struct instr_list* code = instr_list_create();
+            if(!frameless)
             {
-                case TYPE_BOOL:
-                case TYPE_CHAR:
-                case TYPE_INTEGER:
-                    printf(".data\n");
-                    printf("%s: ", pDecl->name);
-                    printf(".quad %d\n", pDecl->value ? pDecl->value->integer_value : 0);
-                    break;
-                case TYPE_STRING:
-                    printf(".data\n");
-                    label = label_name(label_create());
-                    printf("%s: ", label);
-                    printf(".string \"%s\"\n",  pDecl->value ? pDecl->value->string_literal : "");
-                    printf("%s: .quad %s\n", pDecl->name, label);
-                    free((void*)label);
-                    break;
-                case TYPE_ARRAY:
-                    printf(".data\n");
-                    expr_codegen(pDecl->value, pDecl, regs, 0, true);
-                    break;
-                default:
-                    break;
+                instr_emit(code, INSTR_PUSHQ, operand_none(), operand_reg(REG_RBP));
+                instr_emit(code, INSTR_MOVQ, operand_reg(REG_RSP), operand_reg(REG_RBP));
+
+                // Only the callee saved registers the body writes are pushed
+                // after the frame, keep %rsp 16 byte aligned at calls.
+                if((slots + savedCount) % 2 != 0)
+                    slots++;
+                if(slots > 0)
+                    instr_emit(code, INSTR_SUBQ, operand_imm(slots * 8), operand_reg(REG_RSP));
+            }
+
+            for(int i = 0; i < savedCount; i++)
+                instr_emit(code, INSTR_PUSHQ, operand_none(), operand_reg(saved[i]));
+
+            instr_list_print(code);
+            emit_str("\n############################\n\n");
+            instr_list_print(body);
+            emit_str("\n############################\n\n");
+
+            code->size = 0;
+            instr_emit(code, INSTR_LABEL, operand_none(), operand_label(body->epilogue));
+            for(int i = savedCount - 1; i >= 0; i--)
+                instr_emit(code, INSTR_POPQ, operand_none(), operand_reg(saved[i]));
+
+            if(!frameless)
+            {
+                instr_emit(code, INSTR_MOVQ, operand_reg(REG_RBP), operand_reg(REG_RSP));
+                instr_emit(code, INSTR_POPQ, operand_none(), operand_reg(REG_RBP));
+            }
+            instr_emit(code, INSTR_RET, operand_none(), operand_none());
+            instr_list_print(code);
+
+            instr_list_destroy(&code);
+            instr_list_destroy(&body);
+            if(!kept)
+            {
+                ir_func_destroy(&ir);
+                arena_release(mark);
             }
         }
         else
         {
-            expr_codegen(pDecl->value, pDecl, regs, pDecl->symbol->which, false);
-            if(pDecl->value && pDecl->value->reg != -1)
+            if(pDecl->symbol->kind == SYMBOL_GLOBAL)
             {
-                const char* sym_code = symbol_codegen(pDecl->symbol);
-                printf("MOVQ %s, %s\n", scratch_name(regs, pDecl->value->reg), sym_code);
-                scratch_free(regs, pDecl->value->reg);
-                free((void*)sym_code);
+                switch(pDecl->type->kind)
+                {
+                    case TYPE_BOOL:
+                    case TYPE_CHAR:
+                    case TYPE_INTEGER:
+                        emit_str(".data\n");
+                        emit_str(pDecl->name);
+                        emit_str(": .quad ");
+                        emit_int(pDecl->value ? pDecl->value->integer_value : 0);
+                        emit_char('\n');
+                        break;
+                    case TYPE_STRING:
+                        emit_str(".data\n");
+                        emit_str(pDecl->name);
+                        emit_str(": .quad ");
+                        emit_label(string_pool_label(pDecl->value ? pDecl->value->string_literal : ""));
+                        emit_char('\n');
+                        break;
+                    case TYPE_ARRAY:
+                        emit_str(".data\n");
+                        emit_str(pDecl->name);
+                        if(pDecl->value)
+                        {
+                            emit_str(":\n");
+                            expr_codegen(pDecl->value, pDecl, func, 0, true);
+                        }
+                        else
+                        {
+                            emit_str(": .zero ");
+                            emit_int(pDecl->type->value->integer_value * 8);
+                            emit_char('\n');
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+            else
+            {
+                expr_codegen(pDecl->value, pDecl, func, pDecl->symbol->which, false);
+                if(pDecl->value && pDecl->value->reg != -1)
+                    ir_emit(func, IR_COPY, ir_local(func, pDecl->symbol->which), ir_temp_value(pDecl->value->reg), ir_none());
             }
         }
     }
-
-    decl_codegen(pDecl->next, regs);
 }
 
 void decl_print(struct decl* pDecl)
 {
-    if(pDecl)
+    for(; pDecl; pDecl = pDecl->next)
     {
         printf("%s:", pDecl->name);
         type_print(pDecl->type);
@@ -224,84 +286,83 @@ void decl_print(struct decl* pDecl)
         }
 
         printf("\n");
-        decl_print(pDecl->next);
-    }
-}
-
-void decl_destroy(struct decl** ppDecl)
-{
-    if(ppDecl && *ppDecl)
-    {
-        struct decl* pDecl = *ppDecl;
-        decl_destroy(&pDecl->next);
-
-        type_destroy(&pDecl->type);
-        expr_destroy(&pDecl->value);
-        stmt_destroy(&pDecl->code);
-        symbol_destroy(&pDecl->symbol);
-
-        free(pDecl->name);
-        free(pDecl);
-
-        *ppDecl = NULL;
     }
 }
 
-static int pushLocalVarsToStack(struct decl* pDecl)
+/*
+ * Scalars live in registers, only arrays need frame space. Returns the number
+ * of 8 byte slots the function's arrays occupy.
+ */
+static int countDeclarations(struct stmt* pStmt)
 {
-    if(!pDecl) return 0;
-
     int count = 0;
-    struct param_list* pParams = pDecl->type->params;
-    while(pParams)
+    for(; pStmt; pStmt = pStmt->next)
     {
-        count++;
-        pParams = pParams->next;
-    }
-
-    if(pDecl->code->kind == STMT_BLOCK)
-        count += countDeclarations(pDecl->code->body);
-    else
-        count += countDeclarations(pDecl->code);
-
-    moveParamsToStack(pDecl->type->params);
+        struct decl* temp = pStmt->decl;
+        while(temp != NULL)
+        {
+            if(temp->symbol->type->kind == TYPE_ARRAY)
+            {
+                int end = temp->symbol->which + temp->symbol->type->value->integer_value;
+                count = end > count ? end : count;
+            }
 
-    if(count != 0)
-        printf("SUBQ $%d, %%rsp\n", (count + 5) % 2 == 0 ? count * 8 : (count + 1) * 8);
+            temp = temp->next;
+        }
 
+        int nested = countDeclarations(pStmt->body);
+        count = nested > count ? nested : count;
+        nested = countDeclarations(pStmt->else_body);
+        count = nested > count ? nested : count;
+    }
 
     return count;
 }
 
-static int countDeclarations(struct stmt* pStmt)
+/*
+ * Moves a leaf body's slots from below %rbp to the red zone below %rsp, so
+ * it needs no frame. The offsets carry over unchanged since nothing in the
+ * body moves %rsp once the callee saved pushes are done. Leaves code alone
+ * and returns false when the slots do not fit or an argument has to be
+ * read from the caller's frame.
+ */
+static bool useRedZone(struct instr_list* code, int slots)
 {
-    if(!pStmt) return 0;
+    if(slots * 8 > RED_ZONE)
+        return false;
 
-    int count = 0;
-    struct decl* temp = pStmt->decl;
-    while(temp != NULL)
+    for(int i = 0; i < code->size; i++)
     {
-        if(temp->symbol->type->kind == TYPE_ARRAY)
-            count += temp->symbol->type->value->integer_value;
-        else
-            count++;
+        struct operand* ops[2] = {&code->arr[i].src, &code->arr[i].dst};
+        for(int j = 0; j < 2; j++)
+            if(ops[j]->kind == OPERAND_MEM && ops[j]->reg == REG_RBP && ops[j]->value > 0)
+                return false;
+    }
 
-        temp = temp->next;
+    for(int i = 0; i < code->size; i++)
+    {
+        struct operand* ops[2] = {&code->arr[i].src, &code->arr[i].dst};
+        for(int j = 0; j < 2; j++)
+            if(ops[j]->kind == OPERAND_MEM && ops[j]->reg == REG_RBP)
+                ops[j]->reg = REG_RSP;
     }
 
-    return count + countDeclarations(pStmt->next);
+    return true;
 }
 
-static void moveParamsToStack(struct param_list* pParams)
+/*
+ * Copies the incoming arguments into the temps of their params.
+ */
+static void moveParamsToLocals(struct param_list* pParams, struct ir_func* func)
 {
     if(!pParams) return;
 
     int count = 0;
-    char* regs[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
-
     while(pParams)
     {
-        printf("PUSHQ %s\n", regs[count++]);
+        ir_emit(func, IR_PARAM, ir_local(func, pParams->symbol->which), ir_imm(count), ir_none());
+
+        count++;
         pParams = pParams->next;
     }
 }
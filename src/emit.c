@@ -0,0 +1,135 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "emit.h"
+
+#define EMIT_BUFFER_SIZE (1 << 16)
+
+static void emit_bytes(const char* s, size_t n);
+
+// Generated assembly collects here and goes out in EMIT_BUFFER_SIZE writes.
+static char buffer[EMIT_BUFFER_SIZE];
+static size_t used = 0;
+static int out_fd = STDOUT_FILENO;
+
+/*
+ * Sends all further output to fd, stdout until this is called.
+ */
+void emit_open(int fd)
+{
+    emit_flush();
+    out_fd = fd;
+}
+
+void emit_close(void)
+{
+    emit_flush();
+    if(out_fd != STDOUT_FILENO)
+        close(out_fd);
+    out_fd = STDOUT_FILENO;
+}
+
+void emit_flush(void)
+{
+    size_t done = 0;
+    while(done < used)
+    {
+        ssize_t n = write(out_fd, buffer + done, used - done);
+        if(n < 0)
+        {
+            fprintf(stderr, "emit_flush - Failed to write output\n");
+            break;
+        }
+        done += n;
+    }
+
+    used = 0;
+}
+
+void emit_str(const char* s)
+{
+    emit_bytes(s, strlen(s));
+}
+
+void emit_char(char c)
+{
+    if(used == EMIT_BUFFER_SIZE)
+        emit_flush();
+
+    buffer[used++] = c;
+}
+
+void emit_int(long value)
+{
+    char digits[24];
+    int n = sizeof(digits);
+    unsigned long u = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+    do
+    {
+        digits[--n] = '0' + u % 10;
+        u /= 10;
+    } while(u);
+
+    if(value < 0)
+        digits[--n] = '-';
+
+    emit_bytes(digits + n, sizeof(digits) - n);
+}
+
+void emit_label(int label)
+{
+    emit_bytes(".L", 2);
+    emit_int(label);
+}
+
+/*
+ * printf style output for the few places that are not on the per
+ * instruction path, formatted straight into the buffer.
+ */
+void emit_format(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer + used, EMIT_BUFFER_SIZE - used, format, args);
+    va_end(args);
+
+    if(n < 0 || (size_t)n < EMIT_BUFFER_SIZE - used)
+    {
+        used += n > 0 ? n : 0;
+        return;
+    }
+
+    emit_flush();
+    va_start(args, format);
+    n = vsnprintf(buffer, EMIT_BUFFER_SIZE, format, args);
+    va_end(args);
+    used = n < EMIT_BUFFER_SIZE ? n : EMIT_BUFFER_SIZE - 1;
+}
+
+static void emit_bytes(const char* s, size_t n)
+{
+    if(used + n > EMIT_BUFFER_SIZE)
+        emit_flush();
+
+    // Anything too big to buffer at all is written in place.
+    if(n > EMIT_BUFFER_SIZE)
+    {
+        size_t done = 0;
+        while(done < n)
+        {
+            ssize_t w = write(out_fd, s + done, n - done);
+            if(w < 0)
+            {
+                fprintf(stderr, "emit_bytes - Failed to write output\n");
+                return;
+            }
+            done += w;
+        }
+        return;
+    }
+
+    memcpy(buffer + used, s, n);
+    used += n;
+}
@@ -1,25 +1,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
+#include "emit.h"
 #include "expr.h"
+#include "ir.h"
 #include "param_list.h"
 #include "register.h"
+#include "stats.h"
+#include "string_pool.h"
 #include "symbol.h"
-#include "vector.h"
 #include "type.h"
 
 static void print_operator(struct expr* pExpr);
-static void unclean_string(const char* input, char* output);
+static struct expr* expr_alloc(void);
 static int init_list_typecheck(struct type* base, struct expr* list);
-static void moveParamsToRegs(struct expr* pExpr, struct decl* pDecl, struct scratch regs[], int offset, bool isGlobal);
-static bool stringCmp(void* a, void* b);
-static void stringFree(void** item);
+static ir_t expr_ir_op(expr_t kind);
+static void compare_operands(struct expr* pExpr, struct decl* pDecl, struct ir_func* func, struct ir_value* a,
+                             struct ir_value* b);
 
 const int STRMAX = 128;
 
+// Expressions created, and how often expr_typecheck worked out a type versus
+// returning the one already on the node.
+static int expr_count;
+static int typecheck_computed;
+static int typecheck_cached;
+
 struct expr* expr_create(expr_t kind, struct expr* left, struct expr* right)
 {
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
         pExpr->kind = kind;
@@ -29,6 +39,7 @@ struct expr* expr_create(expr_t kind, struct expr* left, struct expr* right)
         pExpr->name = NULL;
         pExpr->string_literal = NULL;
         pExpr->symbol = NULL;
+        pExpr->type = NULL;
         pExpr->reg = -1;
     }
 
@@ -37,7 +48,7 @@ struct expr* expr_create(expr_t kind, struct expr* left, struct expr* right)
 
 struct expr* expr_create_name( const char *name )
 {
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
         pExpr->kind = EXPR_NAME;
@@ -48,6 +59,7 @@ struct expr* expr_create_name( const char *name )
         pExpr->integer_value = 0;
         pExpr->string_literal = NULL;
         pExpr->symbol = NULL;
+        pExpr->type = NULL;
         pExpr->reg = -1;
     }
     
@@ -56,7 +68,7 @@ struct expr* expr_create_name( const char *name )
 
 struct expr* expr_create_integer_literal( int i )
 {
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
         pExpr->kind = EXPR_INT_LITERAL;
@@ -67,6 +79,7 @@ struct expr* expr_create_integer_literal( int i )
         pExpr->name = NULL;
         pExpr->string_literal = NULL;
         pExpr->symbol = NULL;
+        pExpr->type = NULL;
         pExpr->reg = -1;
    }
     
@@ -75,7 +88,7 @@ struct expr* expr_create_integer_literal( int i )
 
 struct expr* expr_create_boolean_literal( int b )
 {
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
         pExpr->kind = EXPR_BOOL_LITERAL;
@@ -86,6 +99,7 @@ struct expr* expr_create_boolean_literal( int b )
         pExpr->name = NULL;
         pExpr->string_literal = NULL;
         pExpr->symbol = NULL;
+        pExpr->type = NULL;
         pExpr->reg = -1;
    }
     
@@ -94,7 +108,7 @@ struct expr* expr_create_boolean_literal( int b )
 
 struct expr* expr_create_char_literal( char c )
 {
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
         pExpr->kind = EXPR_CHAR_LITERAL;
@@ -105,6 +119,7 @@ struct expr* expr_create_char_literal( char c )
         pExpr->name = NULL;
         pExpr->string_literal = NULL;
         pExpr->symbol = NULL;
+        pExpr->type = NULL;
         pExpr->reg = -1;
    }
     
@@ -113,15 +128,14 @@ struct expr* expr_create_char_literal( char c )
 
 struct expr* expr_create_string_literal( const char *str )
 {
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
         pExpr->kind = EXPR_STRING_LITERAL;
-        pExpr->string_literal = malloc(sizeof(char) * strlen(str) + 1);
+        pExpr->string_literal = arena_alloc(strlen(str) + 1);
         if(!pExpr->string_literal)
         {
             fprintf(stderr, "[ERROR] expr_create_string_literal - Failed to allocate space for string literal\n");
-            free(pExpr);
             return NULL;
         }
         strncpy((char*)pExpr->string_literal, str, strlen(str) + 1);
@@ -131,6 +145,7 @@ struct expr* expr_create_string_literal( const char *str )
         pExpr->name = NULL;
         pExpr->integer_value = 0;
         pExpr->symbol = NULL;
+        pExpr->type = NULL;
         pExpr->reg = -1;
    }
     
@@ -141,38 +156,18 @@ struct expr* expr_copy(struct expr* expr)
 {
     if(!expr) return NULL;
 
-    struct expr* pExpr = malloc(sizeof(struct expr));
+    struct expr* pExpr = expr_alloc();
     if(pExpr)
     {
-        pExpr->name = NULL;
-        if(expr->name)
-        {
-            pExpr->name = malloc(sizeof(char) * STRMAX);
-            if(!pExpr->name)
-            {
-                free(pExpr);
-                return NULL;
-            }
-        }
-
-        pExpr->string_literal = NULL;
-        if(expr->string_literal)
-        {
-            pExpr->string_literal = malloc(sizeof(char) * STRMAX);
-            if(!pExpr->string_literal)
-            {
-                if(pExpr->name)
-                    free((char*)pExpr->name);
-                free(pExpr);
-                return NULL;
-            }
-        }
+        pExpr->name = expr->name;
+        pExpr->string_literal = expr->string_literal;
 
         pExpr->kind = expr->kind;
         pExpr->left = expr_copy(expr->left);
         pExpr->right = expr_copy(expr->right);
         pExpr->integer_value = expr->integer_value;
         pExpr->symbol = expr->symbol;
+        pExpr->type = expr->type;
         pExpr->reg = expr->reg;
     }
     
@@ -180,6 +175,14 @@ struct expr* expr_copy(struct expr* expr)
 
 }
 
+// Whether evaluating pExpr calls a function, and so might print or write.
+bool expr_has_call(struct expr* pExpr)
+{
+    if(!pExpr) return false;
+
+    return pExpr->kind == EXPR_CALL || expr_has_call(pExpr->left) || expr_has_call(pExpr->right);
+}
+
 void expr_resolve(struct expr* pExpr)
 {
     if(!pExpr) return;
@@ -196,13 +199,27 @@ void expr_resolve(struct expr* pExpr)
     {
         expr_resolve(pExpr->left);
         expr_resolve(pExpr->right);
+
+        if(pExpr->kind == EXPR_CALL && pExpr->left && pExpr->left->symbol)
+            pExpr->left->symbol->calls++;
     }
 }
 
+/*
+ * The type of an expression, worked out once and kept on the node. Later
+ * calls, and every phase after typechecking, read it back from pExpr->type.
+ */
 struct type* expr_typecheck(struct expr* pExpr)
 {
     if(!pExpr) return NULL;
 
+    if(pExpr->type)
+    {
+        typecheck_cached++;
+        return pExpr->type;
+    }
+    typecheck_computed++;
+
     struct type* lt = expr_typecheck(pExpr->left);
     struct type* rt = expr_typecheck(pExpr->right);
     struct type* type = NULL;
@@ -232,7 +249,7 @@ struct type* expr_typecheck(struct expr* pExpr)
             else
                 symbol = pExpr->symbol;
 
-            type = symbol ? type_copy(symbol->type) : NULL;
+            type = symbol ? symbol->type : NULL;
             break;
         case EXPR_ASSIGN:
             if(!type_equals(lt, rt))
@@ -244,7 +261,7 @@ struct type* expr_typecheck(struct expr* pExpr)
                 printf(")\n");
             }
 
-            type = type_copy(lt);
+            type = lt;
             break;
         case EXPR_OR:
         case EXPR_AND:
@@ -254,7 +271,7 @@ struct type* expr_typecheck(struct expr* pExpr)
                 printf("("); expr_print(pExpr); printf(")\n");
             }
 
-            type = type_copy(lt);
+            type = lt;
             break;
         case EXPR_EQ:
         case EXPR_NE:
@@ -321,7 +338,7 @@ struct type* expr_typecheck(struct expr* pExpr)
             if(lt->kind == TYPE_STRING)
                 type = type_create(TYPE_CHAR, 0, 0, 0);
             else
-                type = lt ? type_copy(lt->subtype) : NULL;
+                type = lt ? lt->subtype : NULL;
             break;
         case EXPR_CALL:
             symbol = scope_lookup(pExpr->left->name);
@@ -333,18 +350,18 @@ struct type* expr_typecheck(struct expr* pExpr)
             }
 
             param_list_typecheck_call(symbol->type->params, pExpr->right);
-            type = lt ? type_copy(lt->subtype) : NULL;
+            type = lt ? lt->subtype : NULL;
             break;
         case EXPR_ARG:
-            type = type_copy(lt);
+            type = lt;
             break;
         case EXPR_GROUP:
-            type = type_copy(lt);
+            type = lt;
             break;
         case EXPR_INIT_LIST:
             size = init_list_typecheck(lt, pExpr);
 
-            type = type_create(TYPE_ARRAY, type_copy(lt), 0, expr_create_integer_literal(size));
+            type = type_array(lt, size);
             break;
         case EXPR_NOT:
             if(lt->kind != TYPE_BOOL)
@@ -370,493 +387,200 @@ struct type* expr_typecheck(struct expr* pExpr)
         break;
     }
 
-    type_destroy(&lt);
-    type_destroy(&rt);
-
+    pExpr->type = type;
     return type;
 }
 
-void expr_codegen(struct expr *pExpr, struct decl *pDecl, struct scratch regs[], int offset, bool isGlobal)
+void expr_typecheck_report(FILE* out)
+{
+    fprintf(out, "typecheck expressions %d\n", expr_count);
+    fprintf(out, "typecheck computed    %d\n", typecheck_computed);
+    fprintf(out, "typecheck cached      %d\n", typecheck_cached);
+}
+
+void expr_codegen(struct expr *pExpr, struct decl *pDecl, struct ir_func* func, int offset, bool isGlobal)
 {
     if(!pExpr) return;
 
-    int r1 = -1, r2 = -1, count = 0;
-    char *loop, *done, *t1;
-    const char* sym_code;
-    const char *l1, *l2;
+    int count = 0, index = 0, temp1;
+    int trueBlock, falseBlock, doneBlock;
+    struct ir_value a, b;
     struct expr* temp;
     struct type* type;
+    struct symbol* sym;
     type_t kind;
-    Vector* vec;
-    char outBuf[256] = {0};
+    struct ir_instr* in;
 
     switch(pExpr->kind)
     {
         case EXPR_CHAR_LITERAL:
         case EXPR_BOOL_LITERAL:
         case EXPR_INT_LITERAL:
-            pExpr->reg = scratch_alloc(regs);
-            printf("MOVQ $%d, %s\n",
-                    pExpr->integer_value, scratch_name(regs, pExpr->reg));
+            pExpr->reg = ir_temp(func);
+            ir_emit(func, IR_CONST, pExpr->reg, ir_imm(pExpr->integer_value), ir_none());
             break;
         case EXPR_STRING_LITERAL:
-            pExpr->reg = scratch_alloc(regs);
-            l1 = label_name(label_create());
-            l2 = label_name(label_create());
-            unclean_string(pExpr->string_literal, outBuf);
-           
-            printf(".data\n");
-            printf("%s: .string \"%s\"\n", l1, outBuf);
-            printf("%s: .quad %s\n", l2, l1);
-            printf(".text\n");
-            printf("MOVQ %s(%%rip), %s\n", l2, scratch_name(regs, pExpr->reg));
-           
-            free((void*)l1);
-            free((void*)l2);
+            pExpr->reg = ir_temp(func);
+            ir_emit(func, IR_STRING, pExpr->reg, ir_none(), ir_none())->name = pExpr->string_literal;
             break;
         case EXPR_NAME:
-            pExpr->reg = scratch_alloc(regs);
-            sym_code = symbol_codegen(pExpr->symbol);
-            printf("MOVQ %s, %s\n",
-                sym_code, scratch_name(regs, pExpr->reg));
-
-            free((void*)sym_code);
+            pExpr->reg = symbol_codegen(pExpr->symbol, func);
             break;
         case EXPR_ASSIGN:
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
-
-            sym_code = symbol_codegen(pExpr->left->symbol);
-
-            printf("MOVQ %s, %s\n",
-                    scratch_name(regs, pExpr->right->reg), sym_code);
-
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-            free((void*)sym_code);
-            break;
-        case EXPR_OR:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
-
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JE %s\n", t1);
-            printf("CMPQ $1, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("JE %s\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("JMP %s\n", done);
-            printf("%s:", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("%s:", done);
-
+            expr_codegen(pExpr->right, pDecl, func, offset, isGlobal);
             pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-            free(t1);
-            free(done);
-            break;
-        case EXPR_AND:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
-
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JNE %s\n", t1);
-            printf("CMPQ $1, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("JNE %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("JMP %s\n", done);
-            printf("%s:", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("%s:", done);
 
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-
-            free(t1);
-            free(done);
-            break;
-        case EXPR_EQ:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
-            type = expr_typecheck(pExpr->left);
-
-            if(type->kind == TYPE_STRING)
+            if(pExpr->left->kind == EXPR_SUBSCRIPT)
             {
-                 printf("MOVQ %s, %%rdi\n", scratch_name(regs, pExpr->left->reg)); 
-                 printf("MOVQ %s, %%rsi\n", scratch_name(regs, pExpr->right->reg));
-                 printf("CALL stringCompare\n");
-                 printf("CMPQ $0, %%rax\n");
-            }
-            else
-            {
-                printf("CMPQ %s, %s\n", scratch_name(regs, pExpr->left->reg),
-                                        scratch_name(regs, pExpr->right->reg));
+                expr_codegen(pExpr->left->right, pDecl, func, offset, isGlobal);
+                in = ir_emit(func, IR_STORE_ELEM, -1, ir_temp_value(pExpr->left->right->reg), ir_temp_value(pExpr->reg));
+                in->symbol = pExpr->left->left->symbol;
+                break;
             }
 
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("JNE %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-            free(t1);
-            free(done);
-            free(type);
-            break;
-        case EXPR_NE:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
-
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ %s, %s\n", scratch_name(regs, pExpr->left->reg), scratch_name(regs, pExpr->right->reg));
-            printf("JE %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-            free(t1);
-            free(done);
-            break;
-        case EXPR_LT:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
-
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ %s, %s\n", scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->left->reg));
-            printf("JGE %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->left->reg;
-            scratch_free(regs, pExpr->right->reg);
-            free(t1);
-            free(done);
-            break;
-        case EXPR_LE:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ %s, %s\n", scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->left->reg));
-            printf("JG %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->left->reg;
-            scratch_free(regs, pExpr->right->reg);
-            free(t1);
-            free(done);
-            break;
-        case EXPR_GT:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ %s, %s\n", scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->left->reg));
-            printf("JLE %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->left->reg;
-            scratch_free(regs, pExpr->right->reg);
-            free(t1);
-            free(done);
+            sym = pExpr->left->symbol;
+            if(sym->kind == SYMBOL_GLOBAL)
+                ir_emit(func, IR_STORE, -1, ir_temp_value(pExpr->reg), ir_none())->symbol = sym;
+            else
+                ir_emit(func, IR_COPY, ir_local(func, sym->which), ir_temp_value(pExpr->reg), ir_none());
             break;
-        case EXPR_GE:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ %s, %s\n", scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->left->reg));
-            printf("JL %s\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->left->reg;
-            scratch_free(regs, pExpr->right->reg);
-            free(t1);
-            free(done);
+        case EXPR_OR:
+        case EXPR_AND:
+            // Only reached for a value, conditions go through expr_codegen_branch.
+            pExpr->reg = ir_temp(func);
+            trueBlock = ir_block_create(func);
+            falseBlock = ir_block_create(func);
+            doneBlock = ir_block_create(func);
+            expr_codegen_branch(pExpr, pDecl, func, trueBlock, falseBlock);
+
+            ir_block_set(func, trueBlock);
+            ir_emit(func, IR_CONST, pExpr->reg, ir_imm(1), ir_none());
+            ir_jump(func, doneBlock);
+            ir_block_set(func, falseBlock);
+            ir_emit(func, IR_CONST, pExpr->reg, ir_imm(0), ir_none());
+            ir_jump(func, doneBlock);
+            ir_block_set(func, doneBlock);
             break;
         case EXPR_ADD:
         case EXPR_SUB:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            printf("%s %s, %s\n", (pExpr->kind == EXPR_ADD) ? "ADDQ" : "SUBQ",
-                    scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->left->reg));
-
-            pExpr->reg = pExpr->left->reg;
-            scratch_free(regs, pExpr->right->reg);
-            break;
         case EXPR_MUL:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            printf("MOVQ %s, %%rax\n", scratch_name(regs, pExpr->left->reg));
-            printf("IMULQ %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("MOVQ %%rax, %s\n", scratch_name(regs, pExpr->right->reg));
-
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-            break;
         case EXPR_DIV:
         case EXPR_MOD:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            printf("MOVQ %s, %%rax\n", scratch_name(regs, pExpr->left->reg));
-            printf("CQTO\n");
-            printf("IDIVQ %s\n", scratch_name(regs, pExpr->right->reg));
-            printf("MOVQ %s, %s\n", (pExpr->kind == EXPR_DIV) ? "%rax" : "%rdx",
-                    scratch_name(regs, pExpr->right->reg));
-
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, pExpr->left->reg);
-            break;
         case EXPR_EXPONENT:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            r1 = scratch_alloc(regs);
-            r2 = scratch_alloc(regs);
-
-            printf("MOVQ %s, %%rax\n", scratch_name(regs, pExpr->left->reg));
-            printf("MOVQ %s, %s\n", scratch_name(regs, pExpr->right->reg), scratch_name(regs, r1));
-            printf("MOVQ %s, %s\n", scratch_name(regs, pExpr->left->reg), scratch_name(regs, r2));
-
-            loop = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("%s:\n", loop);
-            printf("CMPQ $1, %s\n", scratch_name(regs, r1));
-            printf("JLE %s\n", done);
-            printf("IMULQ %s\n", scratch_name(regs, r2));
-            printf("DEC %s\n", scratch_name(regs, r1));
-            printf("JMP %s\n", loop);
-            printf("%s:\n", done);
-            printf("MOVQ %%rax, %s\n", scratch_name(regs, pExpr->right->reg));
+            expr_codegen(pExpr->left, pDecl, func, offset, isGlobal);
+            expr_codegen(pExpr->right, pDecl, func, offset, isGlobal);
 
-            pExpr->reg = pExpr->right->reg;
-            scratch_free(regs, r1);
-            scratch_free(regs, r2);
-            scratch_free(regs, pExpr->left->reg);
+            pExpr->reg = ir_temp(func);
+            ir_emit(func, expr_ir_op(pExpr->kind), pExpr->reg, ir_temp_value(pExpr->left->reg),
+                    ir_temp_value(pExpr->right->reg));
+            break;
+        case EXPR_EQ:
+        case EXPR_NE:
+        case EXPR_LT:
+        case EXPR_LE:
+        case EXPR_GT:
+        case EXPR_GE:
+            compare_operands(pExpr, pDecl, func, &a, &b);
 
-            free(loop);
-            free(done);
+            pExpr->reg = ir_temp(func);
+            ir_emit(func, expr_ir_op(pExpr->kind), pExpr->reg, a, b);
             break;
         case EXPR_INC:
         case EXPR_DEC:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
- 
-            sym_code = symbol_codegen(pExpr->left->symbol);
-            printf("%s %s\n", (pExpr->kind == EXPR_INC) ? "INCQ" : "DECQ", sym_code);
-            printf("MOVQ %s, %s\n", sym_code, scratch_name(regs, pExpr->left->reg));
+            sym = pExpr->left->symbol;
+            pExpr->reg = ir_temp(func);
 
-            free((void*)sym_code);
-            pExpr->reg = pExpr->left->reg;
+            if(sym->kind == SYMBOL_GLOBAL)
+            {
+                temp1 = ir_temp(func);
+                ir_emit(func, IR_LOAD, temp1, ir_none(), ir_none())->symbol = sym;
+                ir_emit(func, pExpr->kind == EXPR_INC ? IR_ADD : IR_SUB, pExpr->reg, ir_temp_value(temp1), ir_imm(1));
+                ir_emit(func, IR_STORE, -1, ir_temp_value(pExpr->reg), ir_none())->symbol = sym;
+            }
+            else
+            {
+                temp1 = ir_local(func, sym->which);
+                ir_emit(func, pExpr->kind == EXPR_INC ? IR_ADD : IR_SUB, temp1, ir_temp_value(temp1), ir_imm(1));
+                ir_emit(func, IR_COPY, pExpr->reg, ir_temp_value(temp1), ir_none());
+            }
             break;
         case EXPR_SUBSCRIPT:
-            pExpr->reg = scratch_alloc(regs);
-            type = expr_typecheck(pExpr);
-            expr_codegen(pExpr->right, pDecl, regs, offset, isGlobal);
- 
-            if(isGlobal || pExpr->left->symbol->kind == SYMBOL_GLOBAL)
-            {
-                
-                if(type->kind == TYPE_STRING)
-                {
-                    printf("MOVQ %s(, %s, 8), %s\n", pExpr->left->name,
-                            scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->reg));
-                }
-                else
-                {
-                    r1 = scratch_alloc(regs);
-                    printf("LEAQ %s(%%rip), %s\n", pExpr->left->name, scratch_name(regs, r1));
-                    printf("MOVQ (%s, %s, 8), %s\n",  scratch_name(regs, r1),
-                            scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->reg));
+            type = pExpr->left->type;
+            expr_codegen(pExpr->right, pDecl, func, offset, isGlobal);
 
-                    scratch_free(regs, r1);
-                }
+            pExpr->reg = ir_temp(func);
+            if(type->kind == TYPE_STRING)
+            {
+                temp1 = symbol_codegen(pExpr->left->symbol, func);
+                ir_emit(func, IR_LOAD_BYTE, pExpr->reg, ir_temp_value(temp1), ir_temp_value(pExpr->right->reg));
             }
             else
             {
-                printf("MOVQ -%d(%%rbp, %s, 8), %s\n", 
-                        (pExpr->left->symbol->type->value->integer_value + pExpr->left->symbol->which) * 8,
-                        scratch_name(regs, pExpr->right->reg), scratch_name(regs, pExpr->reg));
+                in = ir_emit(func, IR_LOAD_ELEM, pExpr->reg, ir_temp_value(pExpr->right->reg), ir_none());
+                in->symbol = pExpr->left->symbol;
             }
-
-            scratch_free(regs, pExpr->right->reg);
             break;
         case EXPR_CALL:
-            if(pExpr->left->symbol)
-                moveParamsToRegs(pExpr->right, pDecl, regs, offset, isGlobal);
-
-            printf("PUSHQ %%r10\n");
-            printf("PUSHQ %%r11\n");
-
-            printf("CALL %s\n", pExpr->left->name);
+            // Every argument is evaluated before any is passed so nested calls
+            // cannot disturb arguments that are already in place.
+            count = 0;
+            for(temp = pExpr->right; temp; temp = temp->right)
+            {
+                expr_codegen(temp->left, pDecl, func, offset, isGlobal);
+                count++;
+            }
 
-            printf("POPQ %%r11\n");
-            printf("POPQ %%r10\n");
+            for(temp = pExpr->right; temp; temp = temp->right)
+                ir_emit(func, IR_ARG, -1, ir_temp_value(temp->left->reg), ir_none());
 
             if(pExpr->left->symbol && pExpr->left->symbol->type->subtype->kind != TYPE_VOID)
-            {
-                pExpr->reg = scratch_alloc(regs);
-                printf("MOVQ %%rax, %s\n", scratch_name(regs, pExpr->reg));
-            }
+                pExpr->reg = ir_temp(func);
 
+            ir_emit(func, IR_CALL, pExpr->reg, ir_imm(count), ir_none())->name = pExpr->left->name;
             break;
         case EXPR_ARG:
             printf("EXPR_ARG - Not Implemented Yet.\n");
             break;
         case EXPR_GROUP:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
+            expr_codegen(pExpr->left, pDecl, func, offset, isGlobal);
             pExpr->reg = pExpr->left->reg;
             break;
         case EXPR_INIT_LIST:
-            type = expr_typecheck(pExpr);
-            kind = type->subtype->kind;
-            type_destroy(&type);
-            
-            count = 0;
-            temp = pExpr;
-            while(temp)
-            {
-                count++;
-                temp = temp->right;
-            }
+            kind = pExpr->type->subtype->kind;
 
-            if(kind == TYPE_INTEGER || kind == TYPE_CHAR || kind == TYPE_BOOL)
+            if(!isGlobal)
             {
-                if(isGlobal)
-                {
-                    printf("\n\t.quad %d\n", pExpr->left->integer_value);
-                    struct expr* temp = pExpr->right;
-                    while(temp)
-                    {
-                        printf("\t.quad %d\n", temp->left->integer_value);
-                        temp = temp->right; 
-                    }
-                }
-                else
+                index = 0;
+                for(temp = pExpr; temp; temp = temp->right)
                 {
-                    printf("MOVQ $%d, -%d(%%rbp)\n", pExpr->left->integer_value, (count+ offset) * 8);
-
-                    temp = pExpr->right;
-                    while(temp)
-                    {
-                        count--;
-                        printf("MOVQ $%d, -%d(%%rbp)\n", temp->left->integer_value, (count + offset) * 8);
-                        temp = temp->right;
-                    }
+                    expr_codegen(temp->left, pDecl, func, offset, isGlobal);
+                    in = ir_emit(func, IR_STORE_ELEM, -1, ir_imm(index++), ir_temp_value(temp->left->reg));
+                    in->symbol = pDecl->symbol;
                 }
             }
             else
             {
-                vec = vectorInit(stringCmp, stringFree);
-                vectorInsert(vec, label_name(label_create()));
-
-                printf(".data\n");
-                printf("%s:\n", (char*)vectorAt(vec, vec->size - 1));
-                printf("\t.string \"%s\"\n", pExpr->left->string_literal);
-                struct expr* temp = pExpr->right;
-                while(temp)
+                // decl_codegen has already written the label.
+                bool strings = kind != TYPE_INTEGER && kind != TYPE_CHAR && kind != TYPE_BOOL;
+                for(temp = pExpr; temp; temp = temp->right)
                 {
-                    vectorInsert(vec, label_name(label_create()));
-                    printf("%s:\n", (char*)vectorAt(vec, vec->size - 1));
-                    printf("\t.string \"%s\"\n", temp->left->string_literal);
-                    temp = temp->right; 
+                    emit_str("\t.quad ");
+                    if(strings)
+                        emit_label(string_pool_label(temp->left->string_literal));
+                    else
+                        emit_int(temp->left->integer_value);
+                    emit_char('\n');
                 }
-
-                if(isGlobal)
-                {
-                    printf("%s:\n", pDecl->name);
-                    for(int i = 0; i < vec->size; i++)
-                        printf("\t.quad %s\n", (char*)vectorAt(vec, i));
-
-                    printf(".text\n");
-                }
-                else
-                {
-                    printf(".text\n");
-                    printf("MOVQ $%s, -%d(%%rbp)\n", (char*)vectorAt(vec, count - 1), (count+ offset) * 8);
-
-                    temp = pExpr->right;
-                    while(temp)
-                    {
-                        count--;
-                        printf("MOVQ $%s, -%d(%%rbp)\n", (char*)vectorAt(vec, count - 1), (count + offset) * 8);
-                        temp = temp->right;
-                    }
-                }
-
-                vectorDestroy(&vec);
             }
 
             break;
         case EXPR_NOT:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
- 
-            t1 = label_name(label_create());
-            done = label_name(label_create());
-
-            printf("CMPQ $0, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JE %s\n", t1);
-            printf("MOVQ $0, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("JMP %s\n", done);
-            printf("%s:\n", t1);
-            printf("MOVQ $1, %s\n", scratch_name(regs, pExpr->left->reg));
-            printf("%s:\n", done);
-
-            pExpr->reg = pExpr->left->reg;
-            free(t1);
-            free(done);
-            break;
         case EXPR_UNARY_MINUS:
-            expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
+            expr_codegen(pExpr->left, pDecl, func, offset, isGlobal);
 
-            r1 = scratch_alloc(regs);
-            printf("MOVQ $0, %s\n", scratch_name(regs, r1));
-            printf("SUBQ %s, %s\n", scratch_name(regs, pExpr->left->reg), scratch_name(regs, r1));
-
-            pExpr->reg = r1;
-            scratch_free(regs, pExpr->left->reg);
+            pExpr->reg = ir_temp(func);
+            ir_emit(func, pExpr->kind == EXPR_NOT ? IR_NOT : IR_NEG, pExpr->reg, ir_temp_value(pExpr->left->reg),
+                    ir_none());
             break;
     default:
         printf("error: invalid expression kind - %d\n", pExpr->kind);
@@ -865,11 +589,62 @@ void expr_codegen(struct expr *pExpr, struct decl *pDecl, struct scratch regs[],
     }
 }
 
+/*
+ * Lowers a condition into jumps to onTrue or onFalse instead of a 0/1 value.
+ * && and || only evaluate their right operand when the left one does not
+ * decide the result, and comparisons branch on the compare itself.
+ */
+void expr_codegen_branch(struct expr* pExpr, struct decl* pDecl, struct ir_func* func, int onTrue, int onFalse)
+{
+    if(!pExpr) return;
+
+    int next;
+    struct ir_value a, b;
+
+    switch(pExpr->kind)
+    {
+        case EXPR_AND:
+            next = ir_block_create(func);
+            expr_codegen_branch(pExpr->left, pDecl, func, next, onFalse);
+            ir_block_set(func, next);
+            expr_codegen_branch(pExpr->right, pDecl, func, onTrue, onFalse);
+            break;
+        case EXPR_OR:
+            next = ir_block_create(func);
+            expr_codegen_branch(pExpr->left, pDecl, func, onTrue, next);
+            ir_block_set(func, next);
+            expr_codegen_branch(pExpr->right, pDecl, func, onTrue, onFalse);
+            break;
+        case EXPR_NOT:
+            expr_codegen_branch(pExpr->left, pDecl, func, onFalse, onTrue);
+            break;
+        case EXPR_GROUP:
+            expr_codegen_branch(pExpr->left, pDecl, func, onTrue, onFalse);
+            break;
+        case EXPR_BOOL_LITERAL:
+            ir_jump(func, pExpr->integer_value ? onTrue : onFalse);
+            break;
+        case EXPR_EQ:
+        case EXPR_NE:
+        case EXPR_LT:
+        case EXPR_LE:
+        case EXPR_GT:
+        case EXPR_GE:
+            compare_operands(pExpr, pDecl, func, &a, &b);
+            ir_branch(func, ir_branch_op(expr_ir_op(pExpr->kind)), a, b, onTrue, onFalse);
+            break;
+        default:
+            expr_codegen(pExpr, pDecl, func, 0, false);
+            ir_branch(func, IR_BR, ir_temp_value(pExpr->reg), ir_none(), onTrue, onFalse);
+            break;
+    }
+}
+
 void expr_print(struct expr* expr)
 {
     if(expr)
     {
-        char buffer[STRMAX];
+        char* buffer;
         switch(expr->kind)
         {
             case EXPR_INT_LITERAL:
@@ -882,9 +657,16 @@ void expr_print(struct expr* expr)
                 printf("%s", expr->integer_value ? "true":"false");
                 break;
             case EXPR_STRING_LITERAL:
+                buffer = malloc(2 * strlen(expr->string_literal) + 1);
+                if(!buffer)
+                {
+                    fprintf(stderr, "expr_print - Failed to allocate space for string literal\n");
+                    break;
+                }
                 unclean_string(expr->string_literal, buffer);
 
                 printf("\"%s\"", buffer);
+                free(buffer);
                 break;
             case EXPR_NAME:
                 printf("%s", expr->name);
@@ -943,26 +725,6 @@ void expr_print(struct expr* expr)
     }
 }
 
-void expr_destroy(struct expr** ppExpr)
-{
-    if(ppExpr && *ppExpr)
-    {
-        struct expr* pExpr = *ppExpr;
-        if(pExpr->name)
-            free((char*)pExpr->name);
-        
-        if(pExpr->string_literal)
-            free((char*)pExpr->string_literal);
-
-        expr_destroy(&pExpr->left);
-        expr_destroy(&pExpr->right);
-
-        free(pExpr);
-
-        *ppExpr = NULL;
-    }
-}
-
 static void print_operator(struct expr* pExpr)
 {
     if(pExpr)
@@ -1025,9 +787,12 @@ static void print_operator(struct expr* pExpr)
     }
 }
 
-static void unclean_string(const char* input, char* output)
+/*
+ * Escapes input for a .string directive. output needs room for
+ * 2 * strlen(input) + 1 bytes.
+ */
+void unclean_string(const char* input, char* output)
 {
-    memset(output, 0, STRMAX);
     int inputLen = strlen(input);
     int outIdx = 0;
 
@@ -1061,6 +826,8 @@ static void unclean_string(const char* input, char* output)
                 break;
         }
     }
+
+    output[outIdx] = '\0';
 }
 
 static int init_list_typecheck(struct type* base, struct expr* list)
@@ -1083,7 +850,6 @@ static int init_list_typecheck(struct type* base, struct expr* list)
             type_print(t); printf(" found in list.\n");
             printf("  - "); expr_print(list); printf("\n");
         }
-        type_destroy(&t);
 
         count++;
         temp = temp->right;
@@ -1092,52 +858,56 @@ static int init_list_typecheck(struct type* base, struct expr* list)
     return count;
 }
 
-static void moveParamsToRegs(struct expr* pExpr, struct decl* pDecl, struct scratch regs[], int offset, bool isGlobal)
+/*
+ * Evaluates both sides of a comparison into the values to compare. Strings
+ * compare through stringCompare, whose result is then compared with 0.
+ */
+static void compare_operands(struct expr* pExpr, struct decl* pDecl, struct ir_func* func, struct ir_value* a,
+                             struct ir_value* b)
 {
+    expr_codegen(pExpr->left, pDecl, func, 0, false);
+    expr_codegen(pExpr->right, pDecl, func, 0, false);
 
-    if(!pExpr) return;
-    
-    char* paramRegs[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+    *a = ir_temp_value(pExpr->left->reg);
+    *b = ir_temp_value(pExpr->right->reg);
 
-    int i = 0;
-    while(pExpr && i < 6)
+    if(pExpr->left->type->kind == TYPE_STRING)
     {
-        expr_codegen(pExpr->left, pDecl, regs, offset, isGlobal);
-        printf("MOVQ %s, %s\n", scratch_name(regs, pExpr->left->reg), paramRegs[i]);
-        scratch_free(regs, pExpr->left->reg);
-
-        pExpr = pExpr->right;
-        i++;
-    }
+        int result = ir_temp(func);
+        ir_emit(func, IR_ARG, -1, *a, ir_none());
+        ir_emit(func, IR_ARG, -1, *b, ir_none());
+        ir_emit(func, IR_CALL, result, ir_imm(2), ir_none())->name = "stringCompare";
 
-    if(pExpr != NULL)
-    {
-        while(pExpr)
-        {
-            printf("PUSHQ %s\n", scratch_name(regs, pExpr->left->reg));
-            pExpr = pExpr->right;
-        }
+        *a = ir_temp_value(result);
+        *b = ir_imm(0);
     }
 }
 
-static bool stringCmp(void* a, void* b)
+/*
+ * The IR operator for a binary or comparison expression.
+ */
+static ir_t expr_ir_op(expr_t kind)
 {
-    if(!a || !b) return false;
-
-    char* strA = (char*)a;
-    char* strB = (char*)b;
-
-    return strncmp(strA, strB, strlen(strA)) == 0;
+    switch(kind)
+    {
+        case EXPR_EQ:       return IR_EQ;
+        case EXPR_NE:       return IR_NE;
+        case EXPR_LT:       return IR_LT;
+        case EXPR_LE:       return IR_LE;
+        case EXPR_GT:       return IR_GT;
+        case EXPR_GE:       return IR_GE;
+        case EXPR_ADD:      return IR_ADD;
+        case EXPR_SUB:      return IR_SUB;
+        case EXPR_MUL:      return IR_MUL;
+        case EXPR_DIV:      return IR_DIV;
+        case EXPR_MOD:      return IR_MOD;
+        default:            return IR_EXP;
+    }
 }
 
-static void stringFree(void** item)
+static struct expr* expr_alloc(void)
 {
-    if(!item) return;
-
-    char** pstr = (char**)item;
-    char* str = *pstr;
-
-    free(str);
-    *pstr = NULL;
+    expr_count++;
+    stats.ast_nodes++;
+    return arena_alloc(sizeof(struct expr));
 }
-
@@ -0,0 +1,577 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "fold.h"
+
+/*
+ * Where each temp is written, and the dominator tree numbered so a block
+ * dominates another when its enter..leave range holds the other's. Blocks
+ * with no path from the entry have an enter of -1.
+ */
+struct dominance
+{
+    int* def_block;
+    int* def_index;
+    int* enter;
+    int* leave;
+};
+
+static bool fold_instr(struct ir_instr* in, long* result);
+static bool fold_branch(struct ir_instr* in, long* result);
+static bool fold_exponent(long base, long count, long* result);
+static bool is_pure(ir_t op);
+static void substitute(struct ir_value* v, bool* known, int* values, struct dominance* dom, int block, int index);
+static bool dominates(struct dominance* dom, int temp, int block, int index);
+static bool dominator_tree(struct ir_func* func, int* enter, int* leave);
+static void remove_dead(struct ir_func* func);
+static void remove_unreachable(struct ir_func* func);
+
+/*
+ * Constant folding and propagation. A temp written exactly once by a
+ * constant holds that constant wherever the write dominates the read;
+ * lowering gives every expression its own temp, so this covers
+ * intermediate results as well as locals that are initialised with a
+ * constant and never reassigned. A local declared without a value and
+ * assigned on only some paths, or after a read in a loop, is left alone.
+ * Instructions whose operands all become constants are evaluated here,
+ * branches on constants become jumps, and whatever is left without a use
+ * or a path from the entry is removed.
+ */
+void fold_function(struct ir_func* func)
+{
+    if(!func || func->temp_count == 0) return;
+
+    int* defs = calloc(func->temp_count, sizeof(int));
+    int* values = calloc(func->temp_count, sizeof(int));
+    bool* known = calloc(func->temp_count, sizeof(bool));
+    struct dominance dom;
+    dom.def_block = malloc(sizeof(int) * func->temp_count);
+    dom.def_index = malloc(sizeof(int) * func->temp_count);
+    dom.enter = malloc(sizeof(int) * func->block_count);
+    dom.leave = malloc(sizeof(int) * func->block_count);
+    if(!defs || !values || !known || !dom.def_block || !dom.def_index || !dom.enter || !dom.leave ||
+       !dominator_tree(func, dom.enter, dom.leave))
+    {
+        fprintf(stderr, "fold_function - Failed to allocate space for constants\n");
+        free(defs);
+        free(values);
+        free(known);
+        free(dom.def_block);
+        free(dom.def_index);
+        free(dom.enter);
+        free(dom.leave);
+        return;
+    }
+
+    for(int b = 0; b < func->block_count; b++)
+    {
+        for(int i = 0; i < func->blocks[b].size; i++)
+        {
+            int dst = func->blocks[b].arr[i].dst;
+            if(dst != -1)
+            {
+                defs[dst]++;
+                dom.def_block[dst] = b;
+                dom.def_index[dst] = i;
+            }
+        }
+    }
+
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int b = 0; b < func->block_count; b++)
+        {
+            struct ir_block* block = &func->blocks[b];
+            for(int i = 0; i < block->size; i++)
+            {
+                struct ir_instr* in = &block->arr[i];
+                substitute(&in->a, known, values, &dom, b, i);
+                substitute(&in->b, known, values, &dom, b, i);
+
+                long result;
+                if(ir_is_branch(in->op))
+                {
+                    if(!fold_branch(in, &result))
+                        continue;
+
+                    in->op = IR_JMP;
+                    block->succ[0] = block->succ[result ? 0 : 1];
+                    block->succ[1] = -1;
+                    in->a = ir_none();
+                    in->b = ir_none();
+                    changed = true;
+                    continue;
+                }
+
+                if(in->dst == -1 || known[in->dst] || defs[in->dst] != 1 || !fold_instr(in, &result))
+                    continue;
+
+                in->op = IR_CONST;
+                in->a = ir_imm(result);
+                in->b = ir_none();
+                known[in->dst] = true;
+                values[in->dst] = result;
+                changed = true;
+            }
+        }
+    }
+
+    free(defs);
+    free(values);
+    free(known);
+    free(dom.def_block);
+    free(dom.def_index);
+    free(dom.enter);
+    free(dom.leave);
+
+    remove_unreachable(func);
+    remove_dead(func);
+}
+
+/*
+ * Evaluates an instruction whose operands are all immediates. Results that
+ * would not fit in a 32 bit immediate, and division by zero, are left for
+ * run time.
+ */
+static bool fold_instr(struct ir_instr* in, long* result)
+{
+    if(in->a.kind != IR_IMM || (in->b.kind != IR_IMM && in->b.kind != IR_NONE))
+        return false;
+
+    long a = in->a.value;
+    long b = in->b.value;
+
+    switch(in->op)
+    {
+        case IR_CONST:
+        case IR_COPY:   *result = a; break;
+        case IR_ADD:    *result = a + b; break;
+        case IR_SUB:    *result = a - b; break;
+        case IR_MUL:    *result = a * b; break;
+        case IR_NEG:    *result = -a; break;
+        case IR_DIV:
+            if(b == 0) return false;
+            *result = a / b;
+            break;
+        case IR_MOD:
+            if(b == 0) return false;
+            *result = a % b;
+            break;
+        case IR_EXP:
+            if(!fold_exponent(a, b, result)) return false;
+            break;
+        case IR_NOT:    *result = !a; break;
+        case IR_EQ:     *result = a == b; break;
+        case IR_NE:     *result = a != b; break;
+        case IR_LT:     *result = a < b; break;
+        case IR_LE:     *result = a <= b; break;
+        case IR_GT:     *result = a > b; break;
+        case IR_GE:     *result = a >= b; break;
+        default:
+            return false;
+    }
+
+    return *result >= INT_MIN && *result <= INT_MAX;
+}
+
+/*
+ * Decides a branch whose operands are all immediates; result is non-zero
+ * when it is taken.
+ */
+static bool fold_branch(struct ir_instr* in, long* result)
+{
+    if(in->op == IR_BR)
+    {
+        if(in->a.kind != IR_IMM)
+            return false;
+
+        *result = in->a.value != 0;
+        return true;
+    }
+
+    struct ir_instr compare = *in;
+    compare.op = ir_compare_op(in->op);
+    return fold_instr(&compare, result);
+}
+
+/*
+ * Matches the run time code, where any count below two gives the base.
+ */
+static bool fold_exponent(long base, long count, long* result)
+{
+    if(count < 1)
+        count = 1;
+
+    if(base == 1)
+        *result = 1;
+    else if(base == 0)
+        *result = 0;
+    else if(base == -1)
+        *result = count % 2 ? -1 : 1;
+    else
+    {
+        // Any other base leaves int range within 32 steps.
+        long value = 1;
+        for(long i = 0; i < count; i++)
+        {
+            value *= base;
+            if(value < INT_MIN || value > INT_MAX)
+                return false;
+        }
+        *result = value;
+    }
+
+    return true;
+}
+
+/*
+ * Instructions with no effect besides writing dst.
+ */
+static bool is_pure(ir_t op)
+{
+    switch(op)
+    {
+        case IR_STORE:
+        case IR_STORE_ELEM:
+        case IR_ARG:
+        case IR_CALL:
+        case IR_RET:
+        case IR_JMP:
+        case IR_DIV:
+        case IR_MOD:
+            return false;
+        default:
+            return !ir_is_branch(op);
+    }
+}
+
+static void substitute(struct ir_value* v, bool* known, int* values, struct dominance* dom, int block, int index)
+{
+    if(v->kind == IR_TEMP && known[v->value] && dominates(dom, v->value, block, index))
+        *v = ir_imm(values[v->value]);
+}
+
+/*
+ * Whether every path to instruction index of block passes the one write of
+ * temp. Folding branches only removes edges, so this stays true while the
+ * blocks change underneath it.
+ */
+static bool dominates(struct dominance* dom, int temp, int block, int index)
+{
+    int def = dom->def_block[temp];
+    if(dom->enter[block] == -1 || dom->enter[def] == -1)
+        return false;
+    if(def == block)
+        return dom->def_index[temp] < index;
+
+    return dom->enter[def] < dom->enter[block] && dom->leave[block] <= dom->leave[def];
+}
+
+/*
+ * Immediate dominators by the iterative method of Cooper, Harvey and
+ * Kennedy ("A Simple, Fast Dominance Algorithm") over reverse postorder,
+ * then a walk of the tree to number it. Both searches keep their own stack
+ * so long functions cannot overflow the C one.
+ */
+static bool dominator_tree(struct ir_func* func, int* enter, int* leave)
+{
+    int n = func->block_count;
+    int* position = malloc(sizeof(int) * n);
+    int* succ = malloc(sizeof(int) * n * 3);
+    int* post = malloc(sizeof(int) * n);
+    int* rpo = malloc(sizeof(int) * n);
+    int* stack = malloc(sizeof(int) * n);
+    int* next = malloc(sizeof(int) * n);
+    int* idom = malloc(sizeof(int) * n);
+    int* first = malloc(sizeof(int) * (n + 1));
+    int* edges = malloc(sizeof(int) * n * 3);
+    if(!position || !succ || !post || !rpo || !stack || !next || !idom || !first || !edges)
+    {
+        free(position);
+        free(succ);
+        free(post);
+        free(rpo);
+        free(stack);
+        free(next);
+        free(idom);
+        free(first);
+        free(edges);
+        return false;
+    }
+
+    for(int b = 0; b < n; b++)
+    {
+        position[b] = -1;
+        post[b] = -1;
+        enter[b] = -1;
+        leave[b] = -1;
+        idom[b] = -1;
+        next[b] = 0;
+    }
+    for(int i = 0; i < func->order_count; i++)
+        position[func->order[i]] = i;
+
+    // A block that does not end in a jump falls into the one laid out next.
+    for(int b = 0; b < n; b++)
+    {
+        struct ir_block* block = &func->blocks[b];
+        succ[b * 3] = block->succ[0];
+        succ[b * 3 + 1] = block->succ[1];
+        succ[b * 3 + 2] = -1;
+        if(position[b] != -1 && !ir_block_terminated(block) && position[b] + 1 < func->order_count)
+            succ[b * 3 + 2] = func->order[position[b] + 1];
+    }
+
+    int entry = func->order[0];
+    int count = 0;
+    int depth = 0;
+    stack[depth++] = entry;
+    post[entry] = 0;
+    while(depth > 0)
+    {
+        int b = stack[depth - 1];
+        if(next[b] < 3)
+        {
+            int s = succ[b * 3 + next[b]++];
+            if(s != -1 && post[s] == -1)
+            {
+                post[s] = 0;
+                stack[depth++] = s;
+            }
+            continue;
+        }
+
+        depth--;
+        post[b] = count;
+        rpo[count++] = b;
+    }
+
+    for(int i = 0; i < count / 2; i++)
+    {
+        int b = rpo[i];
+        rpo[i] = rpo[count - 1 - i];
+        rpo[count - 1 - i] = b;
+    }
+
+    // Predecessors of the reached blocks, grouped by block.
+    for(int b = 0; b <= n; b++)
+        first[b] = 0;
+    for(int i = 0; i < count; i++)
+        for(int k = 0; k < 3; k++)
+            if(succ[rpo[i] * 3 + k] != -1)
+                first[succ[rpo[i] * 3 + k] + 1]++;
+    for(int b = 0; b < n; b++)
+        first[b + 1] += first[b];
+    for(int b = 0; b < n; b++)
+        next[b] = first[b];
+    for(int i = 0; i < count; i++)
+        for(int k = 0; k < 3; k++)
+            if(succ[rpo[i] * 3 + k] != -1)
+                edges[next[succ[rpo[i] * 3 + k]]++] = rpo[i];
+
+    idom[entry] = entry;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int i = 1; i < count; i++)
+        {
+            int b = rpo[i];
+            int dom = -1;
+            for(int e = first[b]; e < first[b + 1]; e++)
+            {
+                int p = edges[e];
+                if(idom[p] == -1)
+                    continue;
+                if(dom == -1)
+                {
+                    dom = p;
+                    continue;
+                }
+
+                int x = p;
+                while(x != dom)
+                {
+                    while(post[x] < post[dom])
+                        x = idom[x];
+                    while(post[dom] < post[x])
+                        dom = idom[dom];
+                }
+            }
+
+            if(idom[b] != dom)
+            {
+                idom[b] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    // Children of each block in the tree, reusing the predecessor lists.
+    for(int b = 0; b <= n; b++)
+        first[b] = 0;
+    for(int i = 1; i < count; i++)
+        first[idom[rpo[i]] + 1]++;
+    for(int b = 0; b < n; b++)
+        first[b + 1] += first[b];
+    for(int b = 0; b < n; b++)
+        next[b] = first[b];
+    for(int i = 1; i < count; i++)
+        edges[next[idom[rpo[i]]]++] = rpo[i];
+    for(int b = 0; b < n; b++)
+        next[b] = first[b];
+
+    int number = 0;
+    depth = 0;
+    stack[depth++] = entry;
+    enter[entry] = number++;
+    while(depth > 0)
+    {
+        int b = stack[depth - 1];
+        if(next[b] < first[b + 1])
+        {
+            int child = edges[next[b]++];
+            enter[child] = number++;
+            stack[depth++] = child;
+            continue;
+        }
+
+        depth--;
+        leave[b] = number;
+    }
+
+    free(position);
+    free(succ);
+    free(post);
+    free(rpo);
+    free(stack);
+    free(next);
+    free(idom);
+    free(first);
+    free(edges);
+    return true;
+}
+
+/*
+ * Drops pure instructions whose result is never read, repeating until
+ * nothing else becomes unused.
+ */
+static void remove_dead(struct ir_func* func)
+{
+    int* uses = malloc(sizeof(int) * func->temp_count);
+    if(!uses)
+    {
+        fprintf(stderr, "remove_dead - Failed to allocate space for use counts\n");
+        return;
+    }
+
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int t = 0; t < func->temp_count; t++)
+            uses[t] = 0;
+
+        for(int b = 0; b < func->block_count; b++)
+        {
+            struct ir_block* block = &func->blocks[b];
+            for(int i = 0; i < block->size; i++)
+            {
+                if(block->arr[i].a.kind == IR_TEMP)
+                    uses[block->arr[i].a.value]++;
+                if(block->arr[i].b.kind == IR_TEMP)
+                    uses[block->arr[i].b.value]++;
+
+                // Element accesses through an array param read the param's pointer.
+                struct symbol* sym = block->arr[i].symbol;
+                if(sym && sym->kind == SYMBOL_PARAM)
+                    uses[ir_local(func, sym->which)]++;
+            }
+        }
+
+        for(int b = 0; b < func->block_count; b++)
+        {
+            struct ir_block* block = &func->blocks[b];
+            int size = 0;
+            for(int i = 0; i < block->size; i++)
+            {
+                struct ir_instr* in = &block->arr[i];
+                if(in->dst != -1 && uses[in->dst] == 0 && is_pure(in->op))
+                {
+                    changed = true;
+                    continue;
+                }
+
+                block->arr[size++] = *in;
+            }
+            block->size = size;
+        }
+    }
+
+    free(uses);
+}
+
+/*
+ * Takes blocks that no longer have a path from the entry out of the layout
+ * and empties them so their instructions count for nothing.
+ */
+static void remove_unreachable(struct ir_func* func)
+{
+    bool* reached = calloc(func->block_count, sizeof(bool));
+    int* work = malloc(sizeof(int) * func->block_count);
+    int* position = malloc(sizeof(int) * func->block_count);
+    if(!reached || !work || !position)
+    {
+        fprintf(stderr, "remove_unreachable - Failed to allocate space for the worklist\n");
+        free(reached);
+        free(work);
+        free(position);
+        return;
+    }
+
+    for(int i = 0; i < func->order_count; i++)
+        position[func->order[i]] = i;
+
+    int count = 0;
+    work[count++] = func->order[0];
+    reached[func->order[0]] = true;
+
+    while(count > 0)
+    {
+        int b = work[--count];
+        struct ir_block* block = &func->blocks[b];
+
+        int succ[3] = {block->succ[0], block->succ[1], -1};
+        if(!ir_block_terminated(block) && position[b] + 1 < func->order_count)
+            succ[2] = func->order[position[b] + 1];
+
+        for(int s = 0; s < 3; s++)
+        {
+            if(succ[s] != -1 && !reached[succ[s]])
+            {
+                reached[succ[s]] = true;
+                work[count++] = succ[s];
+            }
+        }
+    }
+
+    int size = 0;
+    for(int i = 0; i < func->order_count; i++)
+    {
+        int b = func->order[i];
+        if(reached[b])
+            func->order[size++] = b;
+        else
+        {
+            func->blocks[b].size = 0;
+            func->blocks[b].placed = false;
+        }
+    }
+    func->order_count = size;
+
+    free(reached);
+    free(work);
+    free(position);
+}
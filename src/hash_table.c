@@ -3,10 +3,12 @@
 #include <string.h>
 #include "hash_table.h"
 
-extern int STRMAX;
+// Marks a removed slot. Probes run through it; inserts may reuse it.
+static const char TOMBSTONE[] = "";
 
-static int hash(const char* key, int capacity);
-static bool resize(struct hash_table* ht);
+static unsigned long hash(const char* key);
+static int find(struct hash_table* ht, const char* key, unsigned long h);
+static bool resize(struct hash_table* ht, int capacity);
 static bool keys_equal(void* a, void* b);
 static void keys_destroy(void** key);
 
@@ -16,9 +18,10 @@ struct hash_table* hash_table_create(void)
     if(ht)
     {
         ht->size = 0;
+        ht->used = 0;
         ht->capacity = 8;
-        ht->arr = calloc(ht->capacity, sizeof(Node*));
-        if(!ht->arr)
+        ht->slots = calloc(ht->capacity, sizeof(struct hash_slot));
+        if(!ht->slots)
         {
             free(ht);
             fprintf(stderr, "hash_table_create - Failed to allocate space for hash table\n");
@@ -29,39 +32,41 @@ struct hash_table* hash_table_create(void)
     return ht;
 }
 
+/*
+ * Binds key to value, replacing the value if key is already present. The
+ * table is rebuilt before live slots and tombstones together pass 70% of
+ * capacity; it only grows when most of that is live entries.
+ */
 bool hash_table_insert(struct hash_table* ht, const char* key, void* value)
 {
     if(!ht || !key) return false;
 
-    if(ht->size >= ht->capacity)
-        if(!resize(ht))
-            return false;
-
-    int idx = hash(key, ht->capacity);
-
-    if(ht->arr[idx])
-        while(ht->arr[idx % ht->capacity])
-            idx++;
-
-    Node* n = malloc(sizeof(Node));
-    if(!n)
+    unsigned long h = hash(key);
+    int idx = find(ht, key, h);
+    if(idx != -1)
     {
-        fprintf(stderr, "hash_table_insert - Failed to allocate space for new node\n");
-        return false;
+        ht->slots[idx].value = value;
+        return true;
     }
 
-    n->key = malloc(sizeof(char) * STRMAX);
-    if(!n->key)
+    if((ht->used + 1) * 10 > ht->capacity * 7)
     {
-         fprintf(stderr, "hash_table_insert - Failed to allocate space for node key\n");
-         free(n);
-         return false;
+        int capacity = (ht->size + 1) * 2 > ht->capacity ? ht->capacity * 2 : ht->capacity;
+        if(!resize(ht, capacity))
+            return false;
     }
 
-    strncpy(n->key, key, STRMAX);
-    n->value = value;
+    int mask = ht->capacity - 1;
+    idx = h & mask;
+    while(ht->slots[idx].key && ht->slots[idx].key != TOMBSTONE)
+        idx = (idx + 1) & mask;
+
+    if(!ht->slots[idx].key)
+        ht->used++;
 
-    ht->arr[idx % ht->capacity] = n;
+    ht->slots[idx].hash = h;
+    ht->slots[idx].key = key;
+    ht->slots[idx].value = value;
     ht->size++;
     return true;
 }
@@ -70,29 +75,13 @@ void* hash_table_remove(struct hash_table* ht, const char* key)
 {
     if(!ht || !key) return NULL;
 
-    int idx = hash(key, ht->capacity);
-
-    int count = 0;
-    void* value = NULL;
-    while(count < ht->capacity)
-    {
-        if(ht->arr[idx % ht->capacity])
-        {
-            if(strncmp(ht->arr[idx % ht->capacity]->key, key, STRMAX) == 0)
-            {
-                value = ht->arr[idx % ht->capacity]->value;
-                free(ht->arr[idx % ht->capacity]->key);
-                free(ht->arr[idx % ht->capacity]);
-                ht->arr[idx % ht->capacity] = NULL;
-                count = ht->capacity;
-            }
-            else
-                idx++;
-        }
-
-        count++;
-    }
+    int idx = find(ht, key, hash(key));
+    if(idx == -1)
+        return NULL;
 
+    void* value = ht->slots[idx].value;
+    ht->slots[idx].key = TOMBSTONE;
+    ht->slots[idx].value = NULL;
     ht->size--;
     return value;
 }
@@ -101,31 +90,22 @@ void* hash_table_at(struct hash_table* ht, const char* key)
 {
     if(!ht || !key) return NULL;
 
-    int idx = hash(key, ht->capacity);
-    int count = 0;
-
-    while(count < ht->capacity)
-    {
-        if(ht->arr[idx % ht->capacity])
-        {
-            if(strncmp(ht->arr[idx % ht->capacity]->key, key, STRMAX) == 0)
-                return ht->arr[idx % ht->capacity]->value;
-        }
-
-        idx++;
-        count++;
-    }
-
-    return NULL;
+    int idx = find(ht, key, hash(key));
+    return idx == -1 ? NULL : ht->slots[idx].value;
 }
 
+/*
+ * The keys currently in the table. The vector borrows them, so destroying
+ * it leaves the keys alone.
+ */
 Vector* hash_table_keys(struct hash_table* ht)
 {
     if(!ht) return NULL;
 
     Vector* pVector = vectorInit(keys_equal, keys_destroy);
-    for(int i = 0; i < ht->size; i++)
-        vectorInsert(pVector, ht->arr[i]);
+    for(int i = 0; i < ht->capacity; i++)
+        if(ht->slots[i].key && ht->slots[i].key != TOMBSTONE)
+            vectorInsert(pVector, (void*)ht->slots[i].key);
 
     return pVector;
 }
@@ -134,21 +114,12 @@ void hash_table_destroy(struct hash_table** ht)
 {
     if(!ht || !*ht) return;
 
-    for(int i = 0; i < (*ht)->capacity; i++)
-    {
-        if((*ht)->arr[i])
-        {
-            free((*ht)->arr[i]->key);
-            free((*ht)->arr[i]);
-        }
-    }
-
-    free((*ht)->arr);
+    free((*ht)->slots);
     free(*ht);
     *ht = NULL;
 }
 
-static int hash(const char* key, int capacity)
+static unsigned long hash(const char* key)
 {
     const unsigned long FNV_OFFSET = 14695981039346656037UL;
     const unsigned long FNV_PRIME =  1099511628211U;
@@ -159,36 +130,64 @@ static int hash(const char* key, int capacity)
         hash *= FNV_PRIME;
     }
 
-    return hash % capacity;
+    return hash;
+}
+
+/*
+ * The slot holding key, or -1. The stored hash is checked first so a string
+ * compare only happens on a likely match, and not at all when the same
+ * pointer was inserted.
+ */
+static int find(struct hash_table* ht, const char* key, unsigned long h)
+{
+    int mask = ht->capacity - 1;
+    int idx = h & mask;
+
+    while(ht->slots[idx].key)
+    {
+        struct hash_slot* slot = &ht->slots[idx];
+        if(slot->hash == h && slot->key != TOMBSTONE && (slot->key == key || strcmp(slot->key, key) == 0))
+            return idx;
+
+        idx = (idx + 1) & mask;
+    }
+
+    return -1;
 }
 
-static bool resize(struct hash_table* ht)
+/*
+ * Rehashes the live entries into a fresh array of the given power of two
+ * size, dropping every tombstone.
+ */
+static bool resize(struct hash_table* ht, int capacity)
 {
     if(!ht) return false;
 
-    Node** temp = calloc((ht->capacity * 2), sizeof(Node*));
-    if(!temp)
+    struct hash_slot* slots = calloc(capacity, sizeof(struct hash_slot));
+    if(!slots)
+    {
+        fprintf(stderr, "resize - Failed to allocate space for hash table\n");
         return false;
+    }
 
+    int mask = capacity - 1;
     for(int i = 0; i < ht->capacity; i++)
     {
-        Node* n = ht->arr[i];
-        int idx = hash(n->key, ht->capacity * 2);
+        struct hash_slot* slot = &ht->slots[i];
+        if(!slot->key || slot->key == TOMBSTONE)
+            continue;
 
-        if(temp[idx] == NULL)
-            temp[idx] = n;
-        else
-        {
-            while(temp[idx % (ht->capacity * 2)])
-                idx++;
+        int idx = slot->hash & mask;
+        while(slots[idx].key)
+            idx = (idx + 1) & mask;
 
-            temp[idx % (ht->capacity * 2)] = n;
-        }
+        slots[idx] = *slot;
     }
 
-    free(ht->arr);
-    ht->arr = temp;
-    ht->capacity *= 2;
+    free(ht->slots);
+    ht->slots = slots;
+    ht->capacity = capacity;
+    ht->used = ht->size;
 
     return true;
 }
@@ -198,19 +197,11 @@ static bool keys_equal(void* a, void* b)
     if(!a) return b == NULL;
     if(!b) return a == NULL;
 
-    char* keyA = (char*)a;
-    char* keyB = (char*)b;
-    int lenA = strlen(keyA);
-    int lenB = strlen(keyB);
-
-    if(lenA != lenB) return false;
-
-    return strncmp(keyA, keyB, lenA) == 0;
+    return strcmp((char*)a, (char*)b) == 0;
 }
 
 static void keys_destroy(void** key)
 {
-    if(!key || !*key) return;
-    free(*key);
+    if(!key) return;
     *key = NULL;
 }
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inline.h"
+#include "decl.h"
+#include "hash_table.h"
+#include "param_list.h"
+
+/*
+ * Every callee stays in the output as a function of its own, so each
+ * inlined body is a copy and costs its full size. Callees this small cost
+ * about what the call sequence does and are inlined at every call site.
+ */
+#define INLINE_SMALL 24
+// A callee with a single call site is copied only once, so a somewhat
+// larger one still pays for its call overhead.
+#define INLINE_SINGLE 64
+// How far one caller may grow through inlining, in instructions, counting
+// every copied body.
+#define INLINE_BUDGET 1000
+
+/*
+ * A function compiled earlier whose folded IR is kept to be copied into its
+ * callers. Functions are compiled in declaration order and a call can only
+ * name one declared before it, so every callee a caller could inline has
+ * already been seen.
+ */
+struct candidate
+{
+    struct ir_func* func;
+    int size;
+    struct candidate* next;
+};
+
+static struct hash_table* candidates = NULL;
+static struct candidate* candidate_list = NULL;
+
+static int function_size(struct ir_func* func);
+static bool worth_inlining(struct ir_func* func, int size);
+static bool splice(struct ir_func* func, int position, int at, struct ir_func* callee);
+static struct symbol* rename_local(struct symbol* sym, int offset, struct symbol** from, struct symbol** to, int* count);
+
+/*
+ * Replaces calls to registered functions with a copy of their body. The
+ * callee's temps and local arrays are moved past the caller's, its params
+ * become copies of the arguments and each return a copy into the call's
+ * result and a jump to the code after the call. Calls that came in with an
+ * inlined body are left alone; the callee already had its chance at them.
+ */
+void inline_function(struct ir_func* func)
+{
+    if(!func || !candidates) return;
+
+    int size = function_size(func);
+    int budget = size + INLINE_BUDGET;
+
+    for(int pos = 0; pos < func->order_count; pos++)
+    {
+        struct ir_block* block = &func->blocks[func->order[pos]];
+        for(int i = 0; i < block->size; i++)
+        {
+            struct ir_instr* in = &block->arr[i];
+            if(in->op != IR_CALL || !in->name)
+                continue;
+
+            struct candidate* callee = hash_table_at(candidates, in->name);
+            if(!callee || size + callee->size > budget)
+                continue;
+
+            if(!splice(func, pos, i, callee->func))
+                continue;
+
+            // The rest of this block now follows the callee's blocks.
+            size += callee->size;
+            pos += callee->func->order_count;
+            break;
+        }
+    }
+}
+
+/*
+ * Keeps a function's folded IR for later callers if it is worth inlining.
+ * Returns true when the function now belongs to the inliner.
+ */
+bool inline_register(struct ir_func* func)
+{
+    if(!func) return false;
+
+    struct decl* pDecl = func->decl;
+    for(struct param_list* p = pDecl->params; p; p = p->next)
+        if(p->type->kind == TYPE_ARRAY)
+            return false;
+
+    int size = function_size(func);
+    if(!worth_inlining(func, size))
+        return false;
+
+    // A recursive function would only unroll into itself.
+    for(int i = 0; i < func->order_count; i++)
+    {
+        struct ir_block* block = &func->blocks[func->order[i]];
+        for(int j = 0; j < block->size; j++)
+            if(block->arr[j].op == IR_CALL && block->arr[j].name == pDecl->name)
+                return false;
+    }
+
+    if(!candidates)
+    {
+        candidates = hash_table_create();
+        if(!candidates)
+            return false;
+    }
+
+    struct candidate* c = malloc(sizeof(struct candidate));
+    if(!c)
+    {
+        fprintf(stderr, "inline_register - Failed to allocate space for candidate\n");
+        return false;
+    }
+
+    c->func = func;
+    c->size = size;
+    if(!hash_table_insert(candidates, pDecl->name, c))
+    {
+        free(c);
+        return false;
+    }
+
+    c->next = candidate_list;
+    candidate_list = c;
+    return true;
+}
+
+void inline_destroy(void)
+{
+    while(candidate_list)
+    {
+        struct candidate* next = candidate_list->next;
+        ir_func_destroy(&candidate_list->func);
+        free(candidate_list);
+        candidate_list = next;
+    }
+
+    hash_table_destroy(&candidates);
+}
+
+static int function_size(struct ir_func* func)
+{
+    int size = 0;
+    for(int i = 0; i < func->order_count; i++)
+        size += func->blocks[func->order[i]].size;
+
+    return size;
+}
+
+static bool worth_inlining(struct ir_func* func, int size)
+{
+    int calls = func->decl->symbol->calls;
+    if(calls == 0)
+        return false;
+
+    return size <= INLINE_SMALL || (calls == 1 && size <= INLINE_SINGLE);
+}
+
+/*
+ * Copies callee in place of the CALL at index at of the block at position
+ * in the caller's layout. The instructions after the call move to a new
+ * block laid out after the callee's, which the callee's entry follows on
+ * from where the call was.
+ */
+static bool splice(struct ir_func* func, int position, int at, struct ir_func* callee)
+{
+    struct ir_block* block = &func->blocks[func->order[position]];
+    struct ir_instr call = block->arr[at];
+
+    int count = call.a.value;
+    int first = at - count;
+    if(first < 0)
+        return false;
+    for(int i = first; i < at; i++)
+        if(block->arr[i].op != IR_ARG)
+            return false;
+
+    int params = 0;
+    for(struct param_list* p = callee->decl->params; p; p = p->next)
+        params++;
+    if(params != count)
+        return false;
+
+    int* map = malloc(sizeof(int) * callee->block_count);
+    struct ir_value* args = malloc(sizeof(struct ir_value) * (count + 1));
+    struct symbol** from = malloc(sizeof(struct symbol*) * (function_size(callee) + 1));
+    struct symbol** to = malloc(sizeof(struct symbol*) * (function_size(callee) + 1));
+    if(!map || !args || !from || !to)
+    {
+        fprintf(stderr, "splice - Failed to allocate space for the callee\n");
+        free(map);
+        free(args);
+        free(from);
+        free(to);
+        return false;
+    }
+
+    for(int i = 0; i < count; i++)
+        args[i] = block->arr[first + i].a;
+
+    // Blocks left unplaced on failure are never emitted.
+    bool created = true;
+    for(int b = 0; b < callee->block_count; b++)
+        map[b] = -1;
+    for(int i = 0; i < callee->order_count && created; i++)
+        created = (map[callee->order[i]] = ir_block_create(func)) != -1;
+    int next = created ? ir_block_create(func) : -1;
+    if(next == -1)
+    {
+        free(map);
+        free(args);
+        free(from);
+        free(to);
+        return false;
+    }
+
+    block = &func->blocks[func->order[position]];
+    struct ir_block* rest = &func->blocks[next];
+    rest->size = block->size - at - 1;
+    rest->capacity = rest->size;
+    rest->arr = malloc(sizeof(struct ir_instr) * (rest->size + 1));
+    if(!rest->arr)
+    {
+        fprintf(stderr, "splice - Failed to allocate space for the continuation\n");
+        free(map);
+        free(args);
+        free(from);
+        free(to);
+        return false;
+    }
+    memcpy(rest->arr, block->arr + at + 1, sizeof(struct ir_instr) * rest->size);
+    rest->succ[0] = block->succ[0];
+    rest->succ[1] = block->succ[1];
+    rest->placed = true;
+
+    block->size = first;
+    block->succ[0] = -1;
+    block->succ[1] = -1;
+
+    int temps = func->temp_count;
+    int slots = func->frame_slots;
+    int renamed = 0;
+    func->temp_count += callee->temp_count;
+    func->frame_slots += callee->frame_slots;
+
+    for(int i = 0; i < callee->order_count; i++)
+    {
+        struct ir_block* source = &callee->blocks[callee->order[i]];
+        struct ir_block* copy = &func->blocks[map[callee->order[i]]];
+
+        // A return turns into a copy and a jump.
+        copy->capacity = source->size + 1;
+        copy->arr = malloc(sizeof(struct ir_instr) * copy->capacity);
+        if(!copy->arr)
+        {
+            fprintf(stderr, "splice - Failed to allocate space for the callee\n");
+            copy->capacity = 0;
+            continue;
+        }
+        copy->placed = true;
+        for(int s = 0; s < 2; s++)
+            copy->succ[s] = source->succ[s] == -1 ? -1 : map[source->succ[s]];
+
+        for(int j = 0; j < source->size; j++)
+        {
+            struct ir_instr in = source->arr[j];
+            if(in.dst != -1)
+                in.dst += temps;
+            if(in.a.kind == IR_TEMP)
+                in.a.value += temps;
+            if(in.b.kind == IR_TEMP)
+                in.b.value += temps;
+            if(in.symbol && in.symbol->kind == SYMBOL_LOCAL)
+                in.symbol = rename_local(in.symbol, slots, from, to, &renamed);
+
+            if(in.op == IR_PARAM)
+            {
+                in.op = IR_COPY;
+                in.a = args[source->arr[j].a.value];
+            }
+            else if(in.op == IR_RET)
+            {
+                if(call.dst != -1 && in.a.kind != IR_NONE)
+                {
+                    struct ir_instr result = {IR_COPY, call.dst, in.a, ir_none(), NULL, NULL};
+                    copy->arr[copy->size++] = result;
+                }
+
+                in.op = IR_JMP;
+                in.a = ir_none();
+                copy->succ[0] = next;
+            }
+
+            copy->arr[copy->size++] = in;
+        }
+    }
+
+    // Callee blocks and then the continuation go right after the call.
+    int added = callee->order_count + 1;
+    memmove(func->order + position + 1 + added, func->order + position + 1,
+            sizeof(int) * (func->order_count - position - 1));
+    for(int i = 0; i < callee->order_count; i++)
+        func->order[position + 1 + i] = map[callee->order[i]];
+    func->order[position + added] = next;
+    func->order_count += added;
+
+    free(map);
+    free(args);
+    free(from);
+    free(to);
+    return true;
+}
+
+/*
+ * Local arrays are addressed by their slot in the frame, so the callee's
+ * move past the caller's. Each array gets one renamed symbol per splice.
+ */
+static struct symbol* rename_local(struct symbol* sym, int offset, struct symbol** from, struct symbol** to, int* count)
+{
+    for(int i = 0; i < *count; i++)
+        if(from[i] == sym)
+            return to[i];
+
+    struct symbol* copy = symbol_copy(sym);
+    if(!copy)
+        return sym;
+
+    copy->which += offset;
+    from[*count] = sym;
+    to[*count] = copy;
+    (*count)++;
+    return copy;
+}
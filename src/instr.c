@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emit.h"
+#include "instr.h"
+#include "register.h"
+#include "stats.h"
+
+static void emit_operand(struct operand* op);
+static const char* instr_mnemonic(instr_t kind);
+
+struct operand operand_none(void)
+{
+    struct operand op = {OPERAND_NONE, -1, -1, 0, 0, NULL};
+    return op;
+}
+
+struct operand operand_reg(int r)
+{
+    struct operand op = {OPERAND_REG, r, -1, 0, 0, NULL};
+    return op;
+}
+
+struct operand operand_reg8(int r)
+{
+    struct operand op = {OPERAND_REG, r, -1, 1, 0, NULL};
+    return op;
+}
+
+struct operand operand_imm(long value)
+{
+    struct operand op = {OPERAND_IMM, -1, -1, 0, value, NULL};
+    return op;
+}
+
+struct operand operand_mem(int base, int index, int scale, long disp)
+{
+    struct operand op = {OPERAND_MEM, base, index, scale, disp, NULL};
+    return op;
+}
+
+struct operand operand_global(const char* symbol)
+{
+    struct operand op = {OPERAND_MEM, REG_RIP, -1, 0, 0, symbol};
+    return op;
+}
+
+struct operand operand_global_label(int label)
+{
+    struct operand op = {OPERAND_MEM, REG_RIP, -1, 0, label, NULL};
+    return op;
+}
+
+struct operand operand_label(int label)
+{
+    struct operand op = {OPERAND_LABEL, -1, -1, 0, label, NULL};
+    return op;
+}
+
+struct operand operand_symbol(const char* symbol)
+{
+    struct operand op = {OPERAND_SYMBOL, -1, -1, 0, 0, symbol};
+    return op;
+}
+
+struct instr_list* instr_list_create(void)
+{
+    struct instr_list* code = malloc(sizeof(struct instr_list));
+    if(code)
+    {
+        code->size = 0;
+        code->capacity = 64;
+        code->arr = malloc(sizeof(struct instr) * code->capacity);
+        if(!code->arr)
+        {
+            fprintf(stderr, "instr_list_create - Failed to allocate space for instruction list\n");
+            free(code);
+            return NULL;
+        }
+
+        code->vreg_count = 0;
+        code->epilogue = -1;
+    }
+
+    return code;
+}
+
+int instr_list_vreg(struct instr_list* code)
+{
+    return VREG_BASE + code->vreg_count++;
+}
+
+void instr_emit(struct instr_list* code, instr_t kind, struct operand src, struct operand dst)
+{
+    struct instr in = {kind, src, dst, NULL};
+    instr_list_append(code, &in);
+}
+
+void instr_emit_directive(struct instr_list* code, const char* text)
+{
+    struct instr in = {INSTR_DIRECTIVE, operand_none(), operand_none(), malloc(strlen(text) + 1)};
+    if(!in.text)
+    {
+        fprintf(stderr, "instr_emit_directive - Failed to allocate space for directive\n");
+        return;
+    }
+
+    strcpy(in.text, text);
+    instr_list_append(code, &in);
+}
+
+/*
+ * Calls clobber %r10 and %r11, which the allocator may have handed out, so
+ * they are preserved around the call. Two pushes keep %rsp 16 byte aligned.
+ */
+void instr_emit_call(struct instr_list* code, const char* name)
+{
+    instr_emit(code, INSTR_PUSHQ, operand_none(), operand_reg(REG_R10));
+    instr_emit(code, INSTR_PUSHQ, operand_none(), operand_reg(REG_R11));
+    instr_emit(code, INSTR_CALL, operand_none(), operand_symbol(name));
+    instr_emit(code, INSTR_POPQ, operand_none(), operand_reg(REG_R11));
+    instr_emit(code, INSTR_POPQ, operand_none(), operand_reg(REG_R10));
+}
+
+void instr_list_append(struct instr_list* code, struct instr* pInstr)
+{
+    if(!code || !pInstr) return;
+
+    if(code->size >= code->capacity)
+    {
+        struct instr* temp = realloc(code->arr, sizeof(struct instr) * code->capacity * 2);
+        if(!temp)
+        {
+            fprintf(stderr, "instr_list_append - Failed to grow instruction list\n");
+            return;
+        }
+
+        code->arr = temp;
+        code->capacity *= 2;
+    }
+
+    code->arr[code->size++] = *pInstr;
+}
+
+bool instr_list_has_call(struct instr_list* code)
+{
+    for(int i = 0; code && i < code->size; i++)
+        if(code->arr[i].kind == INSTR_CALL)
+            return true;
+
+    return false;
+}
+
+bool instr_is_jump(instr_t kind)
+{
+    return kind >= INSTR_JMP && kind <= INSTR_JGE;
+}
+
+/*
+ * The conditional jump taken exactly when jump is not.
+ */
+instr_t instr_jump_negate(instr_t jump)
+{
+    switch(jump)
+    {
+        case INSTR_JE:  return INSTR_JNE;
+        case INSTR_JNE: return INSTR_JE;
+        case INSTR_JL:  return INSTR_JGE;
+        case INSTR_JLE: return INSTR_JG;
+        case INSTR_JG:  return INSTR_JLE;
+        default:        return INSTR_JL;
+    }
+}
+
+int instr_operand_count(instr_t kind)
+{
+    switch(kind)
+    {
+        case INSTR_CQTO:
+        case INSTR_RET:
+        case INSTR_LABEL:
+        case INSTR_DIRECTIVE:
+            return 0;
+        case INSTR_IMULQ_WIDE:
+        case INSTR_IDIVQ:
+        case INSTR_INCQ:
+        case INSTR_DECQ:
+        case INSTR_NEGQ:
+        case INSTR_PUSHQ:
+        case INSTR_POPQ:
+        case INSTR_CALL:
+        case INSTR_SETE:
+        case INSTR_SETNE:
+        case INSTR_SETL:
+        case INSTR_SETLE:
+        case INSTR_SETG:
+        case INSTR_SETGE:
+            return 1;
+        default:
+            return instr_is_jump(kind) ? 1 : 2;
+    }
+}
+
+void instr_list_print(struct instr_list* code)
+{
+    if(!code) return;
+
+    for(int i = 0; i < code->size; i++)
+    {
+        struct instr* in = &code->arr[i];
+        switch(in->kind)
+        {
+            case INSTR_LABEL:
+                emit_label(in->dst.value);
+                emit_str(":\n");
+                break;
+            case INSTR_DIRECTIVE:
+                emit_str(in->text);
+                emit_char('\n');
+                break;
+            default:
+                stats.instructions++;
+                emit_str(instr_mnemonic(in->kind));
+                if(in->src.kind != OPERAND_NONE)
+                {
+                    emit_char(' ');
+                    emit_operand(&in->src);
+                }
+                if(in->dst.kind != OPERAND_NONE)
+                {
+                    emit_str(in->src.kind != OPERAND_NONE ? ", " : " ");
+                    emit_operand(&in->dst);
+                }
+                emit_char('\n');
+                break;
+        }
+    }
+}
+
+void instr_list_destroy(struct instr_list** ppCode)
+{
+    if(ppCode && *ppCode)
+    {
+        struct instr_list* code = *ppCode;
+        for(int i = 0; i < code->size; i++)
+            free(code->arr[i].text);
+
+        free(code->arr);
+        free(code);
+        *ppCode = NULL;
+    }
+}
+
+static void emit_operand(struct operand* op)
+{
+    switch(op->kind)
+    {
+        case OPERAND_REG:
+            emit_str(op->scale == 1 ? register_name8(op->reg) : register_name(op->reg));
+            break;
+        case OPERAND_IMM:
+            emit_char('$');
+            emit_int(op->value);
+            break;
+        case OPERAND_MEM:
+            if(op->symbol)
+            {
+                emit_str(op->symbol);
+                if(op->value)
+                {
+                    emit_char('+');
+                    emit_int(op->value);
+                }
+            }
+            else if(op->reg == REG_RIP)
+                emit_label(op->value);
+            else if(op->value)
+                emit_int(op->value);
+
+            emit_char('(');
+            if(op->reg != -1)
+                emit_str(register_name(op->reg));
+            if(op->index != -1)
+            {
+                emit_str(", ");
+                emit_str(register_name(op->index));
+                emit_str(", ");
+                emit_int(op->scale);
+            }
+            emit_char(')');
+            break;
+        case OPERAND_LABEL:
+            emit_label(op->value);
+            break;
+        case OPERAND_SYMBOL:
+            emit_str(op->symbol);
+            break;
+        default:
+            break;
+    }
+}
+
+static const char* instr_mnemonic(instr_t kind)
+{
+    switch(kind)
+    {
+        case INSTR_MOVQ:    return "MOVQ";
+        case INSTR_MOVZBQ:  return "MOVZBQ";
+        case INSTR_LEAQ:    return "LEAQ";
+        case INSTR_ADDQ:    return "ADDQ";
+        case INSTR_SUBQ:    return "SUBQ";
+        case INSTR_IMULQ:   return "IMULQ";
+        case INSTR_IMULQ_WIDE: return "IMULQ";
+        case INSTR_IDIVQ:   return "IDIVQ";
+        case INSTR_CQTO:    return "CQTO";
+        case INSTR_XORQ:    return "XORQ";
+        case INSTR_ANDQ:    return "ANDQ";
+        case INSTR_SHLQ:    return "SHLQ";
+        case INSTR_SARQ:    return "SARQ";
+        case INSTR_SHRQ:    return "SHRQ";
+        case INSTR_TESTQ:   return "TESTQ";
+        case INSTR_CMPQ:    return "CMPQ";
+        case INSTR_INCQ:    return "INCQ";
+        case INSTR_DECQ:    return "DECQ";
+        case INSTR_NEGQ:    return "NEGQ";
+        case INSTR_PUSHQ:   return "PUSHQ";
+        case INSTR_POPQ:    return "POPQ";
+        case INSTR_CALL:    return "CALL";
+        case INSTR_RET:     return "RET";
+        case INSTR_JMP:     return "JMP";
+        case INSTR_JE:      return "JE";
+        case INSTR_JNE:     return "JNE";
+        case INSTR_JL:      return "JL";
+        case INSTR_JLE:     return "JLE";
+        case INSTR_JG:      return "JG";
+        case INSTR_JGE:     return "JGE";
+        case INSTR_SETE:    return "SETE";
+        case INSTR_SETNE:   return "SETNE";
+        case INSTR_SETL:    return "SETL";
+        case INSTR_SETLE:   return "SETLE";
+        case INSTR_SETG:    return "SETG";
+        case INSTR_SETGE:   return "SETGE";
+        case INSTR_CMOVE:   return "CMOVE";
+        case INSTR_CMOVNE:  return "CMOVNE";
+        case INSTR_CMOVL:   return "CMOVL";
+        case INSTR_CMOVLE:  return "CMOVLE";
+        case INSTR_CMOVG:   return "CMOVG";
+        case INSTR_CMOVGE:  return "CMOVGE";
+        default:            return "";
+    }
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+#include "hash_table.h"
+#include "stats.h"
+
+#define INTERN_BLOCK 4096
+
+// Interned text is packed into blocks that are only freed all at once.
+struct intern_block
+{
+    struct intern_block* next;
+    int used;
+    int capacity;
+    char text[];
+};
+
+static struct hash_table* intern_table;
+static struct intern_block* intern_blocks;
+
+static char* intern_alloc(int length);
+
+/*
+ * The one copy of an identifier. text must be NUL terminated at length, as
+ * yytext is. Equal identifiers always get the same pointer, so names are
+ * compared with == and never copied or freed by their users.
+ */
+const char* intern(const char* text, int length)
+{
+    if(!text) return NULL;
+
+    if(!intern_table)
+        intern_table = hash_table_create();
+
+    const char* atom = hash_table_at(intern_table, text);
+    if(atom)
+        return atom;
+
+    char* copy = intern_alloc(length + 1);
+    if(!copy)
+        return NULL;
+
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    hash_table_insert(intern_table, copy, copy);
+
+    return copy;
+}
+
+void intern_destroy(void)
+{
+    hash_table_destroy(&intern_table);
+
+    while(intern_blocks)
+    {
+        struct intern_block* next = intern_blocks->next;
+        free(intern_blocks);
+        intern_blocks = next;
+    }
+}
+
+static char* intern_alloc(int length)
+{
+    if(!intern_blocks || intern_blocks->capacity - intern_blocks->used < length)
+    {
+        int capacity = length > INTERN_BLOCK ? length : INTERN_BLOCK;
+        struct intern_block* block = malloc(sizeof(struct intern_block) + capacity);
+        if(!block)
+        {
+            fprintf(stderr, "intern_alloc - Failed to allocate space for identifiers\n");
+            return NULL;
+        }
+
+        block->next = intern_blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        intern_blocks = block;
+    }
+
+    char* text = intern_blocks->text + intern_blocks->used;
+    intern_blocks->used += length;
+
+    stats.allocations++;
+    stats.allocated_bytes += length;
+    return text;
+}
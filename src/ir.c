@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "emit.h"
+#include "decl.h"
+#include "expr.h"
+
+static void print_value(struct ir_value v);
+static const char* ir_op_name(ir_t op);
+
+struct ir_value ir_none(void)
+{
+    struct ir_value v = {IR_NONE, 0};
+    return v;
+}
+
+struct ir_value ir_imm(int value)
+{
+    struct ir_value v = {IR_IMM, value};
+    return v;
+}
+
+struct ir_value ir_temp_value(int temp)
+{
+    struct ir_value v = {IR_TEMP, temp};
+    return v;
+}
+
+struct ir_func* ir_func_create(struct decl* pDecl)
+{
+    struct ir_func* func = malloc(sizeof(struct ir_func));
+    if(func)
+    {
+        func->decl = pDecl;
+        func->temp_count = 0;
+        func->block_count = 0;
+        func->block_capacity = 8;
+        func->blocks = malloc(sizeof(struct ir_block) * func->block_capacity);
+        func->order = malloc(sizeof(int) * func->block_capacity);
+        if(!func->blocks || !func->order)
+        {
+            fprintf(stderr, "ir_func_create - Failed to allocate space for blocks\n");
+            free(func->blocks);
+            free(func->order);
+            free(func);
+            return NULL;
+        }
+        func->order_count = 0;
+
+        func->local_count = 0;
+        func->locals = NULL;
+        func->frame_slots = 0;
+
+        ir_block_set(func, ir_block_create(func));
+    }
+
+    return func;
+}
+
+int ir_temp(struct ir_func* func)
+{
+    return func->temp_count++;
+}
+
+/*
+ * Scalar locals and params are a single temp for the whole function, keyed
+ * by the symbol's slot number.
+ */
+int ir_local(struct ir_func* func, int which)
+{
+    if(which >= func->local_count)
+    {
+        int count = func->local_count ? func->local_count : 8;
+        while(count <= which)
+            count *= 2;
+
+        int* temp = realloc(func->locals, sizeof(int) * count);
+        if(!temp)
+        {
+            fprintf(stderr, "ir_local - Failed to allocate space for locals\n");
+            return -1;
+        }
+
+        for(int i = func->local_count; i < count; i++)
+            temp[i] = -1;
+
+        func->locals = temp;
+        func->local_count = count;
+    }
+
+    if(func->locals[which] == -1)
+        func->locals[which] = ir_temp(func);
+
+    return func->locals[which];
+}
+
+int ir_block_create(struct ir_func* func)
+{
+    if(func->block_count >= func->block_capacity)
+    {
+        struct ir_block* temp = realloc(func->blocks, sizeof(struct ir_block) * func->block_capacity * 2);
+        int* order = temp ? realloc(func->order, sizeof(int) * func->block_capacity * 2) : NULL;
+        if(!temp || !order)
+        {
+            fprintf(stderr, "ir_block_create - Failed to grow block list\n");
+            if(temp)
+                func->blocks = temp;
+            return -1;
+        }
+
+        func->blocks = temp;
+        func->order = order;
+        func->block_capacity *= 2;
+    }
+
+    struct ir_block* block = &func->blocks[func->block_count];
+    block->size = 0;
+    block->capacity = 0;
+    block->arr = NULL;
+    block->succ[0] = -1;
+    block->succ[1] = -1;
+    block->placed = false;
+
+    return func->block_count++;
+}
+
+/*
+ * Makes block the insertion point. The first time a block is set it is placed
+ * after the blocks already placed, so blocks can be created ahead of time as
+ * jump targets and laid out where their code belongs.
+ */
+void ir_block_set(struct ir_func* func, int block)
+{
+    if(!func->blocks[block].placed)
+    {
+        func->blocks[block].placed = true;
+        func->order[func->order_count++] = block;
+    }
+
+    func->current = block;
+}
+
+/*
+ * Appends to the current block. Code following a terminator is unreachable
+ * and lands in a fresh block so every block ends in exactly one terminator.
+ * The returned pointer is valid until the next emit.
+ */
+struct ir_instr* ir_emit(struct ir_func* func, ir_t op, int dst, struct ir_value a, struct ir_value b)
+{
+    struct ir_block* block = &func->blocks[func->current];
+    if(ir_block_terminated(block))
+    {
+        ir_block_set(func, ir_block_create(func));
+        block = &func->blocks[func->current];
+    }
+
+    if(block->size >= block->capacity)
+    {
+        int capacity = block->capacity ? block->capacity * 2 : 8;
+        struct ir_instr* temp = realloc(block->arr, sizeof(struct ir_instr) * capacity);
+        if(!temp)
+        {
+            fprintf(stderr, "ir_emit - Failed to grow block\n");
+            return NULL;
+        }
+
+        block->arr = temp;
+        block->capacity = capacity;
+    }
+
+    struct ir_instr* in = &block->arr[block->size++];
+    in->op = op;
+    in->dst = dst;
+    in->a = a;
+    in->b = b;
+    in->symbol = NULL;
+    in->name = NULL;
+
+    return in;
+}
+
+void ir_jump(struct ir_func* func, int target)
+{
+    // Nothing falls out of a block that already returned or jumped.
+    if(ir_block_terminated(&func->blocks[func->current]))
+        return;
+
+    ir_emit(func, IR_JMP, -1, ir_none(), ir_none());
+    func->blocks[func->current].succ[0] = target;
+}
+
+void ir_branch(struct ir_func* func, ir_t op, struct ir_value a, struct ir_value b, int onTrue, int onFalse)
+{
+    ir_emit(func, op, -1, a, b);
+    func->blocks[func->current].succ[0] = onTrue;
+    func->blocks[func->current].succ[1] = onFalse;
+}
+
+bool ir_block_terminated(struct ir_block* block)
+{
+    return block->size > 0 && ir_is_terminator(block->arr[block->size - 1].op);
+}
+
+bool ir_is_terminator(ir_t op)
+{
+    return op == IR_RET || op == IR_JMP || ir_is_branch(op);
+}
+
+bool ir_is_branch(ir_t op)
+{
+    return op >= IR_BR && op <= IR_BGE;
+}
+
+/*
+ * The compare-and-branch for a comparison, and back. Both groups are
+ * declared in the same order.
+ */
+ir_t ir_branch_op(ir_t compare)
+{
+    return IR_BEQ + (compare - IR_EQ);
+}
+
+ir_t ir_compare_op(ir_t branch)
+{
+    return IR_EQ + (branch - IR_BEQ);
+}
+
+/*
+ * Dumps the function as assembler comments so the dump can sit in the
+ * generated output next to the code it describes. pass names the stage
+ * that produced this version of the IR.
+ */
+void ir_print(struct ir_func* func, const char* pass)
+{
+    if(!func) return;
+
+    emit_format("# IR for %s after %s (%d temps)\n", func->decl->name, pass, func->temp_count);
+    for(int i = 0; i < func->order_count; i++)
+    {
+        int b = func->order[i];
+        struct ir_block* block = &func->blocks[b];
+        emit_format("# B%d:\n", b);
+
+        for(int j = 0; j < block->size; j++)
+        {
+            struct ir_instr* in = &block->arr[j];
+            emit_str("#     ");
+            if(in->dst != -1)
+                emit_format("t%d = ", in->dst);
+
+            emit_str(ir_op_name(in->op));
+            if(in->symbol)
+                emit_format(" %s", in->symbol->name);
+            if(in->op == IR_CALL)
+                emit_format(" %s", in->name);
+
+            if(in->a.kind != IR_NONE)
+            {
+                emit_str(in->symbol || in->op == IR_CALL ? ", " : " ");
+                print_value(in->a);
+            }
+            if(in->b.kind != IR_NONE)
+            {
+                emit_str(", ");
+                print_value(in->b);
+            }
+
+            if(in->op == IR_STRING)
+            {
+                char* buffer = malloc(2 * strlen(in->name) + 1);
+                if(buffer)
+                {
+                    unclean_string(in->name, buffer);
+                    emit_format(" \"%s\"", buffer);
+                    free(buffer);
+                }
+                else
+                    fprintf(stderr, "ir_print - Failed to allocate space for string\n");
+            }
+            if(in->op == IR_JMP)
+                emit_format(" B%d", block->succ[0]);
+            if(ir_is_branch(in->op))
+                emit_format(", B%d, B%d", block->succ[0], block->succ[1]);
+
+            emit_char('\n');
+        }
+    }
+}
+
+void ir_func_destroy(struct ir_func** pFunc)
+{
+    if(pFunc && *pFunc)
+    {
+        struct ir_func* func = *pFunc;
+        for(int b = 0; b < func->block_count; b++)
+            free(func->blocks[b].arr);
+
+        free(func->blocks);
+        free(func->order);
+        free(func->locals);
+        free(func);
+        *pFunc = NULL;
+    }
+}
+
+static void print_value(struct ir_value v)
+{
+    if(v.kind == IR_TEMP)
+        emit_format("t%d", v.value);
+    else if(v.kind == IR_IMM)
+        emit_format("%d", v.value);
+}
+
+static const char* ir_op_name(ir_t op)
+{
+    switch(op)
+    {
+        case IR_CONST:      return "const";
+        case IR_COPY:       return "copy";
+        case IR_PARAM:      return "param";
+        case IR_ADD:        return "add";
+        case IR_SUB:        return "sub";
+        case IR_MUL:        return "mul";
+        case IR_DIV:        return "div";
+        case IR_MOD:        return "mod";
+        case IR_EXP:        return "exp";
+        case IR_NEG:        return "neg";
+        case IR_NOT:        return "not";
+        case IR_EQ:         return "eq";
+        case IR_NE:         return "ne";
+        case IR_LT:         return "lt";
+        case IR_LE:         return "le";
+        case IR_GT:         return "gt";
+        case IR_GE:         return "ge";
+        case IR_LOAD:       return "load";
+        case IR_STORE:      return "store";
+        case IR_ADDR:       return "addr";
+        case IR_LOAD_ELEM:  return "load_elem";
+        case IR_STORE_ELEM: return "store_elem";
+        case IR_LOAD_BYTE:  return "load_byte";
+        case IR_STRING:     return "string";
+        case IR_ARG:        return "arg";
+        case IR_CALL:       return "call";
+        case IR_RET:        return "ret";
+        case IR_JMP:        return "jmp";
+        case IR_BR:         return "br";
+        case IR_BEQ:        return "beq";
+        case IR_BNE:        return "bne";
+        case IR_BLT:        return "blt";
+        case IR_BLE:        return "ble";
+        case IR_BGT:        return "bgt";
+        case IR_BGE:        return "bge";
+        default:            return "?";
+    }
+}
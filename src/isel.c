@@ -0,0 +1,1011 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decl.h"
+#include "expr.h"
+#include "isel.h"
+#include "register.h"
+#include "string_pool.h"
+#include "type.h"
+
+typedef enum {TILE_NONE, TILE_MEMORY, TILE_SCALED} tile_t;
+
+// How each temp of the function being selected is folded into its single
+// use, and the operand that use reads in its place.
+static tile_t* tiles;
+static struct operand* tiled;
+
+static void tile_block(struct ir_func* func, struct ir_block* block, int* uses);
+static bool tile_fits(struct ir_instr* use, tile_t kind, bool inA, bool inB);
+static int scaled_index(struct ir_instr* in, int* scale);
+static void isel_instr(struct ir_func* func, struct instr_list* code, struct ir_instr* in, struct ir_value* args, int* argCount);
+static void isel_binary(struct instr_list* code, instr_t kind, int dst, struct ir_value a, struct ir_value b);
+static void isel_multiply(struct instr_list* code, int dst, struct ir_value a, long c);
+static void isel_divide(struct instr_list* code, bool mod, int dst, struct ir_value a, long d);
+static void isel_exponent(struct instr_list* code, int dst, struct ir_value a, struct ir_value b);
+static void magic_divisor(long d, long* magic, int* shift);
+static int log2_exact(long c);
+static void isel_call(struct instr_list* code, struct ir_instr* in, struct ir_value* args);
+static void isel_cmpq(struct instr_list* code, struct ir_value a, struct ir_value b);
+static instr_t isel_compare(struct instr_list* code, struct ir_instr* in);
+static void isel_branch(struct instr_list* code, struct ir_instr* in, int onTrue, int onFalse,
+                        bool trueNext, bool falseNext);
+static int select_shape(struct ir_func* func, struct ir_block* block, int* preds, int* defs, int arms[2]);
+static bool select_arm(struct ir_block* block, int preds, int* defs, int* x, int* join);
+static bool isel_select(struct ir_func* func, struct instr_list* code, struct ir_block* block, int* preds, int* defs,
+                        int* labels, int next);
+static void isel_setcc(struct instr_list* code, instr_t jump, int dst);
+static struct operand value(struct ir_value v);
+static int value_reg(struct instr_list* code, struct ir_value v);
+static struct operand element(struct ir_func* func, struct instr_list* code, struct symbol* sym, struct ir_value index);
+static instr_t jump_condition(ir_t compare);
+
+/*
+ * Selects x86 instructions for an IR function. IR temps become the virtual
+ * registers of the same number; anything the selector needs on top of that
+ * gets a fresh one. Blocks are emitted in placement order and jumps to the
+ * block that follows are dropped.
+ */
+struct instr_list* isel_function(struct ir_func* func)
+{
+    if(!func) return NULL;
+
+    struct instr_list* code = instr_list_create();
+    code->vreg_count = func->temp_count;
+    code->epilogue = label_create();
+
+    // Arguments are queued by ARG until the CALL that consumes them.
+    int argCount = 0;
+    for(int b = 0; b < func->block_count; b++)
+        for(int j = 0; j < func->blocks[b].size; j++)
+            argCount += func->blocks[b].arr[j].op == IR_ARG;
+
+    int* labels = malloc(sizeof(int) * func->block_count);
+    int* preds = calloc(func->block_count, sizeof(int));
+    int* defs = calloc(func->temp_count + 1, sizeof(int));
+    int* uses = calloc(func->temp_count + 1, sizeof(int));
+    bool* skip = calloc(func->block_count, sizeof(bool));
+    struct ir_value* args = malloc(sizeof(struct ir_value) * (argCount + 1));
+    tiles = calloc(func->temp_count + 1, sizeof(tile_t));
+    tiled = malloc(sizeof(struct operand) * (func->temp_count + 1));
+    argCount = 0;
+    if(!labels || !preds || !defs || !uses || !skip || !args || !tiles || !tiled)
+    {
+        fprintf(stderr, "isel_function - Failed to allocate space for block labels\n");
+        free(labels);
+        free(preds);
+        free(defs);
+        free(uses);
+        free(skip);
+        free(args);
+        free(tiles);
+        free(tiled);
+        tiles = NULL;
+        tiled = NULL;
+        return code;
+    }
+
+    for(int i = 0; i < func->order_count; i++)
+    {
+        struct ir_block* block = &func->blocks[func->order[i]];
+        for(int s = 0; s < 2; s++)
+            if(block->succ[s] != -1)
+                preds[block->succ[s]]++;
+        for(int j = 0; j < block->size; j++)
+        {
+            struct ir_instr* in = &block->arr[j];
+            if(in->dst != -1)
+                defs[in->dst]++;
+            if(in->a.kind == IR_TEMP)
+                uses[in->a.value]++;
+            if(in->b.kind == IR_TEMP)
+                uses[in->b.value]++;
+        }
+    }
+
+    for(int i = 0; i < func->order_count; i++)
+        tile_block(func, &func->blocks[func->order[i]], uses);
+
+    // The arms of a select are emitted with the branch that leads to them.
+    for(int i = 0; i < func->order_count; i++)
+    {
+        int arms[2];
+        if(select_shape(func, &func->blocks[func->order[i]], preds, defs, arms) != -1)
+            for(int s = 0; s < 2; s++)
+                if(arms[s] != -1)
+                    skip[arms[s]] = true;
+    }
+
+    for(int b = 0; b < func->block_count; b++)
+        labels[b] = label_create();
+
+    bool first = true;
+    for(int i = 0; i < func->order_count; i++)
+    {
+        int b = func->order[i];
+        if(skip[b])
+            continue;
+
+        int next = -1;
+        for(int k = i + 1; k < func->order_count && next == -1; k++)
+            if(!skip[func->order[k]])
+                next = func->order[k];
+
+        struct ir_block* block = &func->blocks[b];
+
+        if(!first)
+            instr_emit(code, INSTR_LABEL, operand_none(), operand_label(labels[b]));
+        first = false;
+
+        for(int j = 0; j < block->size; j++)
+        {
+            struct ir_instr* in = &block->arr[j];
+            switch(in->op)
+            {
+                case IR_JMP:
+                    if(block->succ[0] != next)
+                        instr_emit(code, INSTR_JMP, operand_none(), operand_label(labels[block->succ[0]]));
+                    break;
+                case IR_BR:
+                case IR_BEQ:
+                case IR_BNE:
+                case IR_BLT:
+                case IR_BLE:
+                case IR_BGT:
+                case IR_BGE:
+                    if(!isel_select(func, code, block, preds, defs, labels, next))
+                        isel_branch(code, in, labels[block->succ[0]], labels[block->succ[1]],
+                                block->succ[0] == next, block->succ[1] == next);
+                    break;
+                case IR_RET:
+                    if(in->a.kind != IR_NONE)
+                        instr_emit(code, INSTR_MOVQ, value(in->a), operand_reg(REG_RAX));
+                    if(next != -1)
+                        instr_emit(code, INSTR_JMP, operand_none(), operand_label(code->epilogue));
+                    break;
+                default:
+                    isel_instr(func, code, in, args, &argCount);
+                    break;
+            }
+        }
+    }
+
+    free(labels);
+    free(preds);
+    free(defs);
+    free(uses);
+    free(skip);
+    free(args);
+    free(tiles);
+    free(tiled);
+    tiles = NULL;
+    tiled = NULL;
+
+    return code;
+}
+
+/*
+ * Tree tiling within a block. A load, or a multiply of a temp by 1, 2, 4 or
+ * 8, whose only use comes a little later in the same block is folded into
+ * that use: the load as a memory operand, the multiply as the scaled index
+ * of a LEAQ. Nothing between the two may write what the folded operand
+ * reads, and a load is not moved past a store or a call.
+ */
+static void tile_block(struct ir_func* func, struct ir_block* block, int* uses)
+{
+    for(int j = 0; j < block->size; j++)
+    {
+        struct ir_instr* in = &block->arr[j];
+        if(in->dst == -1 || uses[in->dst] != 1)
+            continue;
+
+        tile_t kind;
+        int scale;
+        int reads[2] = {-1, -1};
+        if(in->op == IR_LOAD)
+            kind = TILE_MEMORY;
+        else if(in->op == IR_LOAD_ELEM)
+        {
+            kind = TILE_MEMORY;
+            if(in->a.kind == IR_TEMP)
+                reads[0] = in->a.value;
+            if(in->symbol->kind == SYMBOL_PARAM)
+                reads[1] = ir_local(func, in->symbol->which);
+        }
+        else if(in->op == IR_MUL && (reads[0] = scaled_index(in, &scale)) != -1 && tiles[reads[0]] == TILE_NONE)
+            kind = TILE_SCALED;
+        else
+            continue;
+
+        for(int k = j + 1; k < block->size; k++)
+        {
+            struct ir_instr* use = &block->arr[k];
+            bool inA = use->a.kind == IR_TEMP && use->a.value == in->dst;
+            bool inB = use->b.kind == IR_TEMP && use->b.value == in->dst;
+            if(inA || inB)
+            {
+                if(tile_fits(use, kind, inA, inB))
+                    tiles[in->dst] = kind;
+                break;
+            }
+
+            if(use->dst != -1 && (use->dst == reads[0] || use->dst == reads[1]))
+                break;
+            if(kind == TILE_MEMORY && (use->op == IR_STORE || use->op == IR_STORE_ELEM || use->op == IR_CALL))
+                break;
+        }
+    }
+}
+
+/*
+ * Whether use can take a folded operand where it reads the tiled temp.
+ */
+static bool tile_fits(struct ir_instr* use, tile_t kind, bool inA, bool inB)
+{
+    if(kind == TILE_SCALED)
+    {
+        // Only one side of the add can be the index.
+        struct ir_value other = inA ? use->b : use->a;
+        return use->op == IR_ADD && !(inA && inB) && (other.kind != IR_TEMP || tiles[other.value] != TILE_SCALED);
+    }
+
+    switch(use->op)
+    {
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+        case IR_BEQ:
+        case IR_BNE:
+        case IR_BLT:
+        case IR_BLE:
+        case IR_BGT:
+        case IR_BGE:
+            return true;
+        case IR_RET:
+        case IR_STORE:
+            return inA;
+        case IR_STORE_ELEM:
+            return inB && !inA;
+        default:
+            return false;
+    }
+}
+
+/*
+ * The temp a multiply scales by an address scale factor, or -1.
+ */
+static int scaled_index(struct ir_instr* in, int* scale)
+{
+    struct ir_value x = in->a, k = in->b;
+    if(x.kind == IR_IMM)
+    {
+        x = in->b;
+        k = in->a;
+    }
+
+    if(x.kind != IR_TEMP || k.kind != IR_IMM)
+        return -1;
+    if(k.value != 1 && k.value != 2 && k.value != 4 && k.value != 8)
+        return -1;
+
+    *scale = k.value;
+    return x.value;
+}
+
+static void isel_instr(struct ir_func* func, struct instr_list* code, struct ir_instr* in, struct ir_value* args, int* argCount)
+{
+    static const int paramRegs[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
+
+    int dst = in->dst != -1 ? VREG_BASE + in->dst : -1;
+    int r1;
+
+    // Folded into its use, which reads the operand recorded here.
+    if(dst != -1 && tiles[in->dst] != TILE_NONE)
+    {
+        if(tiles[in->dst] == TILE_SCALED)
+        {
+            int scale;
+            int index = scaled_index(in, &scale);
+            tiled[in->dst] = operand_mem(-1, VREG_BASE + index, scale, 0);
+        }
+        else if(in->op == IR_LOAD)
+            tiled[in->dst] = operand_global(in->symbol->name);
+        else
+            tiled[in->dst] = element(func, code, in->symbol, in->a);
+        return;
+    }
+
+    switch(in->op)
+    {
+        case IR_CONST:
+        case IR_COPY:
+            instr_emit(code, INSTR_MOVQ, value(in->a), operand_reg(dst));
+            break;
+        case IR_PARAM:
+            // Arguments past the sixth were pushed by the caller above the return address.
+            if(in->a.value < 6)
+                instr_emit(code, INSTR_MOVQ, operand_reg(paramRegs[in->a.value]), operand_reg(dst));
+            else
+                instr_emit(code, INSTR_MOVQ, operand_mem(REG_RBP, -1, 0, 16 + (in->a.value - 6) * 8), operand_reg(dst));
+            break;
+        case IR_ADD:
+            isel_binary(code, INSTR_ADDQ, dst, in->a, in->b);
+            break;
+        case IR_SUB:
+            isel_binary(code, INSTR_SUBQ, dst, in->a, in->b);
+            break;
+        case IR_MUL:
+            if(in->a.kind == IR_IMM || in->b.kind == IR_IMM)
+                isel_multiply(code, dst, in->a.kind == IR_IMM ? in->b : in->a,
+                              in->a.kind == IR_IMM ? in->a.value : in->b.value);
+            else
+                isel_binary(code, INSTR_IMULQ, dst, in->a, in->b);
+            break;
+        case IR_NEG:
+            instr_emit(code, INSTR_MOVQ, value(in->a), operand_reg(dst));
+            instr_emit(code, INSTR_NEGQ, operand_none(), operand_reg(dst));
+            break;
+        case IR_DIV:
+        case IR_MOD:
+            if(in->b.kind == IR_IMM && in->b.value != 0)
+            {
+                isel_divide(code, in->op == IR_MOD, dst, in->a, in->b.value);
+                break;
+            }
+
+            r1 = value_reg(code, in->b);
+            instr_emit(code, INSTR_MOVQ, value(in->a), operand_reg(REG_RAX));
+            instr_emit(code, INSTR_CQTO, operand_none(), operand_none());
+            instr_emit(code, INSTR_IDIVQ, operand_none(), operand_reg(r1));
+            instr_emit(code, INSTR_MOVQ, operand_reg(in->op == IR_DIV ? REG_RAX : REG_RDX), operand_reg(dst));
+            break;
+        case IR_EXP:
+            isel_exponent(code, dst, in->a, in->b);
+            break;
+        case IR_EQ:
+        case IR_NE:
+        case IR_LT:
+        case IR_LE:
+        case IR_GT:
+        case IR_GE:
+            isel_cmpq(code, in->a, in->b);
+            isel_setcc(code, jump_condition(in->op), dst);
+            break;
+        case IR_NOT:
+            instr_emit(code, INSTR_CMPQ, operand_imm(0), operand_reg(value_reg(code, in->a)));
+            isel_setcc(code, INSTR_JE, dst);
+            break;
+        case IR_LOAD:
+            instr_emit(code, INSTR_MOVQ, operand_global(in->symbol->name), operand_reg(dst));
+            break;
+        case IR_STORE:
+            instr_emit(code, INSTR_MOVQ, value(in->a), operand_global(in->symbol->name));
+            break;
+        case IR_ADDR:
+            instr_emit(code, INSTR_LEAQ, element(func, code, in->symbol, ir_imm(0)), operand_reg(dst));
+            break;
+        case IR_LOAD_ELEM:
+            instr_emit(code, INSTR_MOVQ, element(func, code, in->symbol, in->a), operand_reg(dst));
+            break;
+        case IR_STORE_ELEM:
+            instr_emit(code, INSTR_MOVQ, value(in->b), element(func, code, in->symbol, in->a));
+            break;
+        case IR_LOAD_BYTE:
+            r1 = value_reg(code, in->a);
+            if(in->b.kind == IR_IMM)
+                instr_emit(code, INSTR_MOVZBQ, operand_mem(r1, -1, 0, in->b.value), operand_reg(dst));
+            else
+                instr_emit(code, INSTR_MOVZBQ, operand_mem(r1, VREG_BASE + in->b.value, 1, 0), operand_reg(dst));
+            break;
+        case IR_STRING:
+            instr_emit(code, INSTR_LEAQ, operand_global_label(string_pool_label(in->name)), operand_reg(dst));
+            break;
+        case IR_ARG:
+            args[(*argCount)++] = in->a;
+            break;
+        case IR_CALL:
+            *argCount -= in->a.value;
+            isel_call(code, in, args + *argCount);
+            break;
+        default:
+            fprintf(stderr, "isel_instr - Unexpected IR op %d\n", in->op);
+            break;
+    }
+}
+
+/*
+ * Compares a with b. The right operand of CMPQ cannot be an immediate but
+ * can be memory.
+ */
+static void isel_cmpq(struct instr_list* code, struct ir_value a, struct ir_value b)
+{
+    struct operand left = a.kind == IR_IMM ? operand_reg(value_reg(code, a)) : value(a);
+    instr_emit(code, INSTR_CMPQ, value(b), left);
+}
+
+/*
+ * dst = a op b with the two operand x86 form. When dst is also the right
+ * operand of a non-commutative op the result is built in a scratch vreg.
+ */
+static void isel_binary(struct instr_list* code, instr_t kind, int dst, struct ir_value a, struct ir_value b)
+{
+    if(kind == INSTR_ADDQ && a.kind == IR_TEMP && tiles[a.value] == TILE_SCALED)
+    {
+        struct ir_value t = a;
+        a = b;
+        b = t;
+    }
+
+    // Adds that leave both operands alone are one LEAQ, x + i*8 included.
+    if(kind == INSTR_ADDQ && b.kind == IR_TEMP && tiles[b.value] == TILE_SCALED)
+    {
+        struct operand addr = tiled[b.value];
+        if(a.kind == IR_IMM)
+            addr.value = a.value;
+        else
+            addr.reg = value_reg(code, a);
+
+        instr_emit(code, INSTR_LEAQ, addr, operand_reg(dst));
+        return;
+    }
+
+    if(kind == INSTR_ADDQ && a.kind == IR_IMM)
+    {
+        struct ir_value t = a;
+        a = b;
+        b = t;
+    }
+
+    bool aInReg = a.kind == IR_TEMP && tiles[a.value] == TILE_NONE && VREG_BASE + a.value != dst;
+    bool bInReg = b.kind == IR_TEMP && tiles[b.value] == TILE_NONE && VREG_BASE + b.value != dst;
+    if(aInReg && (kind == INSTR_ADDQ || kind == INSTR_SUBQ) && b.kind == IR_IMM)
+    {
+        long disp = kind == INSTR_ADDQ ? b.value : -(long)b.value;
+        instr_emit(code, INSTR_LEAQ, operand_mem(VREG_BASE + a.value, -1, 0, disp), operand_reg(dst));
+        return;
+    }
+    if(aInReg && bInReg && kind == INSTR_ADDQ)
+    {
+        instr_emit(code, INSTR_LEAQ, operand_mem(VREG_BASE + a.value, VREG_BASE + b.value, 1, 0), operand_reg(dst));
+        return;
+    }
+
+    bool aIsDst = a.kind == IR_TEMP && VREG_BASE + a.value == dst;
+    bool bIsDst = b.kind == IR_TEMP && VREG_BASE + b.value == dst;
+
+    if(bIsDst && !aIsDst)
+    {
+        if(kind != INSTR_SUBQ)
+        {
+            struct ir_value t = a;
+            a = b;
+            b = t;
+            aIsDst = true;
+        }
+        else
+        {
+            int r1 = instr_list_vreg(code);
+            instr_emit(code, INSTR_MOVQ, value(a), operand_reg(r1));
+            instr_emit(code, kind, value(b), operand_reg(r1));
+            instr_emit(code, INSTR_MOVQ, operand_reg(r1), operand_reg(dst));
+            return;
+        }
+    }
+
+    if(!aIsDst)
+        instr_emit(code, INSTR_MOVQ, value(a), operand_reg(dst));
+    instr_emit(code, kind, value(b), operand_reg(dst));
+}
+
+/*
+ * dst = a * c. Powers of two shift, 3, 5 and 9 are a single LEAQ and
+ * anything else keeps the immediate IMULQ.
+ */
+static void isel_multiply(struct instr_list* code, int dst, struct ir_value a, long c)
+{
+    int k = log2_exact(c);
+    if(c == 0)
+    {
+        instr_emit(code, INSTR_MOVQ, operand_imm(0), operand_reg(dst));
+        return;
+    }
+    if(c == -1)
+    {
+        instr_emit(code, INSTR_MOVQ, value(a), operand_reg(dst));
+        instr_emit(code, INSTR_NEGQ, operand_none(), operand_reg(dst));
+        return;
+    }
+    if(k >= 0)
+    {
+        instr_emit(code, INSTR_MOVQ, value(a), operand_reg(dst));
+        if(k > 0)
+            instr_emit(code, INSTR_SHLQ, operand_imm(k), operand_reg(dst));
+        return;
+    }
+    if(c == 3 || c == 5 || c == 9)
+    {
+        int n = value_reg(code, a);
+        instr_emit(code, INSTR_LEAQ, operand_mem(n, n, c - 1, 0), operand_reg(dst));
+        return;
+    }
+
+    isel_binary(code, INSTR_IMULQ, dst, a, ir_imm(c));
+}
+
+/*
+ * dst = a / d or a % d for a constant d other than zero, rounding toward
+ * zero like IDIVQ. Powers of two shift with a bias that rounds negative
+ * dividends up. Other divisors take the high half of a multiply by a magic
+ * number (Hacker's Delight, chapter 10), which goes through %rax and %rdx
+ * like IDIVQ does.
+ */
+static void isel_divide(struct instr_list* code, bool mod, int dst, struct ir_value a, long d)
+{
+    int n = value_reg(code, a);
+
+    if(d == 1 || d == -1)
+    {
+        if(mod)
+            instr_emit(code, INSTR_MOVQ, operand_imm(0), operand_reg(dst));
+        else
+        {
+            instr_emit(code, INSTR_MOVQ, operand_reg(n), operand_reg(dst));
+            if(d == -1)
+                instr_emit(code, INSTR_NEGQ, operand_none(), operand_reg(dst));
+        }
+        return;
+    }
+
+    int k = log2_exact(d < 0 ? -d : d);
+    if(k > 0)
+    {
+        // bias is 2^k - 1 for negative dividends and 0 otherwise.
+        int bias = instr_list_vreg(code);
+        instr_emit(code, INSTR_MOVQ, operand_reg(n), operand_reg(bias));
+        instr_emit(code, INSTR_SARQ, operand_imm(63), operand_reg(bias));
+        instr_emit(code, INSTR_SHRQ, operand_imm(64 - k), operand_reg(bias));
+
+        int r = instr_list_vreg(code);
+        instr_emit(code, INSTR_MOVQ, operand_reg(n), operand_reg(r));
+        instr_emit(code, INSTR_ADDQ, operand_reg(bias), operand_reg(r));
+        if(mod)
+        {
+            instr_emit(code, INSTR_ANDQ, operand_imm((1L << k) - 1), operand_reg(r));
+            instr_emit(code, INSTR_SUBQ, operand_reg(bias), operand_reg(r));
+        }
+        else
+        {
+            instr_emit(code, INSTR_SARQ, operand_imm(k), operand_reg(r));
+            if(d < 0)
+                instr_emit(code, INSTR_NEGQ, operand_none(), operand_reg(r));
+        }
+        instr_emit(code, INSTR_MOVQ, operand_reg(r), operand_reg(dst));
+        return;
+    }
+
+    long magic;
+    int shift;
+    magic_divisor(d, &magic, &shift);
+
+    instr_emit(code, INSTR_MOVQ, operand_imm(magic), operand_reg(REG_RAX));
+    instr_emit(code, INSTR_IMULQ_WIDE, operand_none(), operand_reg(n));
+    if(d > 0 && magic < 0)
+        instr_emit(code, INSTR_ADDQ, operand_reg(n), operand_reg(REG_RDX));
+    else if(d < 0 && magic > 0)
+        instr_emit(code, INSTR_SUBQ, operand_reg(n), operand_reg(REG_RDX));
+    if(shift > 0)
+        instr_emit(code, INSTR_SARQ, operand_imm(shift), operand_reg(REG_RDX));
+
+    // Add one when the quotient is negative.
+    instr_emit(code, INSTR_MOVQ, operand_reg(REG_RDX), operand_reg(REG_RAX));
+    instr_emit(code, INSTR_SHRQ, operand_imm(63), operand_reg(REG_RAX));
+    instr_emit(code, INSTR_ADDQ, operand_reg(REG_RAX), operand_reg(REG_RDX));
+
+    // The remainder is a - q * d, built in %rdx so a spilled dst is one store.
+    if(mod)
+    {
+        instr_emit(code, INSTR_IMULQ, operand_imm(d), operand_reg(REG_RDX));
+        instr_emit(code, INSTR_NEGQ, operand_none(), operand_reg(REG_RDX));
+        instr_emit(code, INSTR_ADDQ, operand_reg(n), operand_reg(REG_RDX));
+    }
+    instr_emit(code, INSTR_MOVQ, operand_reg(REG_RDX), operand_reg(dst));
+}
+
+/*
+ * dst = a ^ b, a itself for any b below two. A constant b is unrolled into
+ * squarings and multiplies by its bits; otherwise b is halved in a loop
+ * that squares the base, taking O(log b) multiplies instead of b.
+ */
+static void isel_exponent(struct instr_list* code, int dst, struct ir_value a, struct ir_value b)
+{
+    if(b.kind == IR_IMM)
+    {
+        long n = b.value < 1 ? 1 : b.value;
+        int base = value_reg(code, a);
+        int r = instr_list_vreg(code);
+        instr_emit(code, INSTR_MOVQ, operand_reg(base), operand_reg(r));
+
+        int top = 30;
+        while(!(n & (1L << top)))
+            top--;
+        for(int bit = top - 1; bit >= 0; bit--)
+        {
+            instr_emit(code, INSTR_IMULQ, operand_reg(r), operand_reg(r));
+            if(n & (1L << bit))
+                instr_emit(code, INSTR_IMULQ, operand_reg(base), operand_reg(r));
+        }
+        instr_emit(code, INSTR_MOVQ, operand_reg(r), operand_reg(dst));
+        return;
+    }
+
+    int r = instr_list_vreg(code);
+    int base = instr_list_vreg(code);
+    int e = instr_list_vreg(code);
+    int loop = label_create();
+    int skip = label_create();
+    int done = label_create();
+
+    instr_emit(code, INSTR_MOVQ, operand_imm(1), operand_reg(r));
+    instr_emit(code, INSTR_MOVQ, value(a), operand_reg(base));
+    instr_emit(code, INSTR_MOVQ, value(b), operand_reg(e));
+
+    // An exponent below one counts as one; r still holds 1 here.
+    instr_emit(code, INSTR_CMPQ, operand_imm(1), operand_reg(e));
+    instr_emit(code, INSTR_CMOVL, operand_reg(r), operand_reg(e));
+
+    instr_emit(code, INSTR_LABEL, operand_none(), operand_label(loop));
+    instr_emit(code, INSTR_TESTQ, operand_imm(1), operand_reg(e));
+    instr_emit(code, INSTR_JE, operand_none(), operand_label(skip));
+    instr_emit(code, INSTR_IMULQ, operand_reg(base), operand_reg(r));
+    instr_emit(code, INSTR_LABEL, operand_none(), operand_label(skip));
+    instr_emit(code, INSTR_SARQ, operand_imm(1), operand_reg(e));
+    instr_emit(code, INSTR_JE, operand_none(), operand_label(done));
+    instr_emit(code, INSTR_IMULQ, operand_reg(base), operand_reg(base));
+    instr_emit(code, INSTR_JMP, operand_none(), operand_label(loop));
+
+    instr_emit(code, INSTR_LABEL, operand_none(), operand_label(done));
+    instr_emit(code, INSTR_MOVQ, operand_reg(r), operand_reg(dst));
+}
+
+/*
+ * Magic number and shift for signed 64 bit division by d, |d| >= 2, from
+ * Hacker's Delight figure 10-1. The sign of d is folded into magic.
+ */
+static void magic_divisor(long d, long* magic, int* shift)
+{
+    const unsigned long two63 = 1UL << 63;
+    unsigned long ad = d < 0 ? -(unsigned long)d : (unsigned long)d;
+    unsigned long t = two63 + ((unsigned long)d >> 63);
+    unsigned long anc = t - 1 - t % ad;
+    unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+    unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+    unsigned long delta;
+    int p = 63;
+
+    do
+    {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if(r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if(r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while(q1 < delta || (q1 == delta && r1 == 0));
+
+    *magic = (long)(q2 + 1);
+    if(d < 0)
+        *magic = -*magic;
+    *shift = p - 64;
+}
+
+/*
+ * k when c is 2^k, -1 otherwise.
+ */
+static int log2_exact(long c)
+{
+    if(c <= 0 || (c & (c - 1)) != 0)
+        return -1;
+
+    int k = 0;
+    while(c > 1)
+    {
+        c >>= 1;
+        k++;
+    }
+    return k;
+}
+
+/*
+ * %r10 and %r11 are caller saved and may hold live vregs, so they are pushed
+ * around the call. Arguments past the sixth are pushed right to left, padded
+ * to keep %rsp 16 byte aligned.
+ */
+static void isel_call(struct instr_list* code, struct ir_instr* in, struct ir_value* args)
+{
+    static const int paramRegs[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9};
+    int count = in->a.value;
+
+    instr_emit(code, INSTR_PUSHQ, operand_none(), operand_reg(REG_R10));
+    instr_emit(code, INSTR_PUSHQ, operand_none(), operand_reg(REG_R11));
+
+    int stackArgs = count > 6 ? count - 6 : 0;
+    if(stackArgs % 2 != 0)
+        instr_emit(code, INSTR_SUBQ, operand_imm(8), operand_reg(REG_RSP));
+
+    for(int i = count - 1; i >= 6; i--)
+        instr_emit(code, INSTR_PUSHQ, operand_none(), value(args[i]));
+
+    for(int i = 0; i < count && i < 6; i++)
+        instr_emit(code, INSTR_MOVQ, value(args[i]), operand_reg(paramRegs[i]));
+
+    // printList is variadic, so %al must hold how many vector registers carry
+    // arguments, which is none.
+    if(strcmp(in->name, "printList") == 0)
+        instr_emit(code, INSTR_XORQ, operand_reg(REG_RAX), operand_reg(REG_RAX));
+
+    instr_emit(code, INSTR_CALL, operand_none(), operand_symbol(in->name));
+
+    if(stackArgs > 0)
+        instr_emit(code, INSTR_ADDQ, operand_imm((stackArgs + stackArgs % 2) * 8), operand_reg(REG_RSP));
+
+    instr_emit(code, INSTR_POPQ, operand_none(), operand_reg(REG_R11));
+    instr_emit(code, INSTR_POPQ, operand_none(), operand_reg(REG_R10));
+
+    if(in->dst != -1)
+        instr_emit(code, INSTR_MOVQ, operand_reg(REG_RAX), operand_reg(VREG_BASE + in->dst));
+}
+
+/*
+ * Emits the compare for a branch and returns the jump taken when its
+ * condition holds.
+ */
+static instr_t isel_compare(struct instr_list* code, struct ir_instr* in)
+{
+    if(in->op == IR_BR)
+    {
+        instr_emit(code, INSTR_CMPQ, operand_imm(0), operand_reg(value_reg(code, in->a)));
+        return INSTR_JNE;
+    }
+
+    isel_cmpq(code, in->a, in->b);
+    return jump_condition(ir_compare_op(in->op));
+}
+
+/*
+ * Compares and jumps straight to the successor blocks. Whichever successor
+ * follows in the layout is reached by falling through.
+ */
+static void isel_branch(struct instr_list* code, struct ir_instr* in, int onTrue, int onFalse,
+                        bool trueNext, bool falseNext)
+{
+    instr_t jump = isel_compare(code, in);
+
+    if(trueNext)
+        instr_emit(code, instr_jump_negate(jump), operand_none(), operand_label(onFalse));
+    else
+    {
+        instr_emit(code, jump, operand_none(), operand_label(onTrue));
+        if(!falseNext)
+            instr_emit(code, INSTR_JMP, operand_none(), operand_label(onFalse));
+    }
+}
+
+/*
+ * A branch whose successors do nothing but pick the value of one temp
+ * before meeting again:
+ *
+ *     br -> T, J   T: x = v; jmp J                          (triangle)
+ *     br -> T, F   T: x = v; jmp J   F: x = w; jmp J        (diamond)
+ *
+ * Fills arms with T and F, -1 for a side that goes straight to the join,
+ * and returns the join block, or -1 when the branch has another shape.
+ */
+static int select_shape(struct ir_func* func, struct ir_block* block, int* preds, int* defs, int arms[2])
+{
+    if(!ir_block_terminated(block) || !ir_is_branch(block->arr[block->size - 1].op))
+        return -1;
+
+    int x[2], join[2];
+    bool arm[2];
+    for(int s = 0; s < 2; s++)
+        arm[s] = select_arm(&func->blocks[block->succ[s]], preds[block->succ[s]], defs, &x[s], &join[s]);
+
+    arms[0] = -1;
+    arms[1] = -1;
+    if(arm[0] && arm[1] && join[0] == join[1] && x[0] == x[1])
+    {
+        // The false value is written first, so the true one must not read x.
+        struct ir_block* t = &func->blocks[block->succ[0]];
+        struct ir_value v = t->arr[t->size - 2].a;
+        if(v.kind == IR_TEMP && v.value == x[0])
+            return -1;
+
+        arms[0] = block->succ[0];
+        arms[1] = block->succ[1];
+        return join[0];
+    }
+    if(arm[0] && join[0] == block->succ[1])
+    {
+        arms[0] = block->succ[0];
+        return join[0];
+    }
+    if(arm[1] && join[1] == block->succ[0])
+    {
+        arms[1] = block->succ[1];
+        return join[1];
+    }
+
+    return -1;
+}
+
+/*
+ * One side of a select: reached only from the branch, a few constants or
+ * copies into temps written nowhere else, then x = v and a jump. Running it
+ * whichever way the branch goes changes nothing but x.
+ */
+static bool select_arm(struct ir_block* block, int preds, int* defs, int* x, int* join)
+{
+    if(preds != 1 || block->size < 2 || block->size > 4 || block->arr[block->size - 1].op != IR_JMP)
+        return false;
+
+    for(int i = 0; i < block->size - 1; i++)
+    {
+        struct ir_instr* in = &block->arr[i];
+        if((in->op != IR_CONST && in->op != IR_COPY) || in->dst == -1)
+            return false;
+        if(i < block->size - 2 && defs[in->dst] != 1)
+            return false;
+    }
+
+    *x = block->arr[block->size - 2].dst;
+    *join = block->succ[0];
+    return true;
+}
+
+/*
+ * Emits a select as a conditional move in place of the branch ending block.
+ * Returns false when the branch is not a select.
+ */
+static bool isel_select(struct ir_func* func, struct instr_list* code, struct ir_block* block, int* preds, int* defs,
+                        int* labels, int next)
+{
+    int arms[2];
+    int join = select_shape(func, block, preds, defs, arms);
+    if(join == -1)
+        return false;
+
+    // Prefixes only write their own temps, so they can run before the compare.
+    struct ir_value v[2];
+    int x = -1;
+    for(int s = 0; s < 2; s++)
+    {
+        if(arms[s] == -1)
+            continue;
+
+        struct ir_block* arm = &func->blocks[arms[s]];
+        for(int i = 0; i < arm->size - 2; i++)
+            instr_emit(code, INSTR_MOVQ, value(arm->arr[i].a), operand_reg(VREG_BASE + arm->arr[i].dst));
+
+        v[s] = arm->arr[arm->size - 2].a;
+        x = VREG_BASE + arm->arr[arm->size - 2].dst;
+    }
+
+    // CMOV cannot take an immediate; the MOVQ for it goes before the compare.
+    int src = value_reg(code, arms[0] != -1 ? v[0] : v[1]);
+    instr_t jump = isel_compare(code, &block->arr[block->size - 1]);
+
+    if(arms[0] != -1 && arms[1] != -1)
+        instr_emit(code, INSTR_MOVQ, value(v[1]), operand_reg(x));
+    if(arms[0] == -1)
+        jump = instr_jump_negate(jump);
+
+    instr_emit(code, INSTR_CMOVE + (jump - INSTR_JE), operand_reg(src), operand_reg(x));
+
+    if(join != next)
+        instr_emit(code, INSTR_JMP, operand_none(), operand_label(labels[join]));
+
+    return true;
+}
+
+/*
+ * Turns the flags of the preceding compare into 0 or 1 in dst without a
+ * branch: SETcc writes the low byte and MOVZBQ clears the rest.
+ */
+static void isel_setcc(struct instr_list* code, instr_t jump, int dst)
+{
+    instr_emit(code, INSTR_SETE + (jump - INSTR_JE), operand_none(), operand_reg8(dst));
+    instr_emit(code, INSTR_MOVZBQ, operand_reg8(dst), operand_reg(dst));
+}
+
+static struct operand value(struct ir_value v)
+{
+    if(v.kind == IR_IMM)
+        return operand_imm(v.value);
+    if(tiles[v.value] == TILE_MEMORY)
+        return tiled[v.value];
+
+    return operand_reg(VREG_BASE + v.value);
+}
+
+/*
+ * Places an immediate or a folded load in a vreg for instructions that
+ * need a register.
+ */
+static int value_reg(struct instr_list* code, struct ir_value v)
+{
+    if(v.kind == IR_TEMP && tiles[v.value] == TILE_NONE)
+        return VREG_BASE + v.value;
+
+    int r = instr_list_vreg(code);
+    instr_emit(code, INSTR_MOVQ, value(v), operand_reg(r));
+    return r;
+}
+
+/*
+ * Memory operand for element index of an array. Globals go through a LEAQ of
+ * their %rip address, params hold a pointer and locals sit below %rbp with
+ * element 0 at the lowest address.
+ */
+static struct operand element(struct ir_func* func, struct instr_list* code, struct symbol* sym, struct ir_value index)
+{
+    struct operand op;
+    if(sym->kind == SYMBOL_GLOBAL)
+    {
+        if(index.kind == IR_IMM)
+        {
+            op = operand_global(sym->name);
+            op.value = index.value * 8;
+            return op;
+        }
+
+        int base = instr_list_vreg(code);
+        instr_emit(code, INSTR_LEAQ, operand_global(sym->name), operand_reg(base));
+        op = operand_mem(base, -1, 0, 0);
+    }
+    else if(sym->kind == SYMBOL_PARAM)
+        op = operand_mem(VREG_BASE + ir_local(func, sym->which), -1, 0, 0);
+    else
+        op = operand_mem(REG_RBP, -1, 0, -(sym->type->value->integer_value + sym->which) * 8);
+
+    if(index.kind == IR_IMM)
+        op.value += index.value * 8;
+    else
+    {
+        op.index = VREG_BASE + index.value;
+        op.scale = 8;
+    }
+
+    return op;
+}
+
+/*
+ * The conditional jump taken when a comparison holds.
+ */
+static instr_t jump_condition(ir_t compare)
+{
+    switch(compare)
+    {
+        case IR_EQ: return INSTR_JE;
+        case IR_NE: return INSTR_JNE;
+        case IR_LT: return INSTR_JL;
+        case IR_LE: return INSTR_JLE;
+        case IR_GT: return INSTR_JG;
+        default:    return INSTR_JGE;
+    }
+}
@@ -1,61 +1,121 @@
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include "arena.h"
 #include "decl.h"
+#include "emit.h"
+#include "expr.h"
+#include "inline.h"
+#include "intern.h"
+#include "options.h"
+#include "peephole.h"
 #include "stack.h"
+#include "stats.h"
+#include "string_pool.h"
+#include "type.h"
 
 extern FILE* yyin;
 extern int yyparse();
 extern void yylex_destroy();
 extern struct decl* parser_result;
-extern struct stack* scope_stack;
+
+struct options options = {false, false, false, false, false, false};
 
 int main(int argc, char* argv[])
 {
-    if(argc == 2)
-        yyin = fopen(argv[1], "r");
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--dump-ir") == 0)
+            options.dump_ir = true;
+        else if(strcmp(argv[i], "--peephole-stats") == 0)
+            options.peephole_stats = true;
+        else if(strcmp(argv[i], "--typecheck-stats") == 0)
+            options.typecheck_stats = true;
+        else if(strcmp(argv[i], "--stats") == 0)
+            options.stats = true;
+        else if(strcmp(argv[i], "--leaf-functions") == 0)
+            options.leaf_functions = true;
+        else if(strcmp(argv[i], "--inline") == 0)
+            options.inline_functions = true;
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            int fd = open(argv[++i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0)
+            {
+                fprintf(stderr, "main - Failed to open %s for writing\n", argv[i]);
+                return 1;
+            }
+            emit_open(fd);
+        }
+        else
+            yyin = fopen(argv[i], "r");
+    }
+
+    stats_phase_begin("parse");
+    int status = yyparse();
+    stats_phase_end();
 
-    if(yyparse()==0)
+    if(status==0)
     {
         fclose(yyin);
         yylex_destroy();
 
-        struct scratch regs[] = {
-            {0, false, "%rbx"},
-            {1, false, "%r10"},
-            {2, false, "%r11"},
-            {3, false, "%r12"},
-            {4, false, "%r13"},
-            {5, false, "%r14"},
-            {6, false, "%r15"}
-        };
-
         scope_enter();
        
+        stats_phase_begin("resolve");
         decl_resolve(parser_result);
-        decl_typecheck(parser_result);
+        stats_phase_end();
 
+        stats_phase_begin("typecheck");
+        decl_typecheck(parser_result);
+        stats_phase_end();
 
-        printf(".global main\n");
-        decl_codegen(parser_result, regs);
+        stats_phase_begin("codegen");
+        emit_str(".global main\n");
+        decl_codegen(parser_result, NULL);
 
         if(parser_result->type->kind == TYPE_FUNCTION)
         {
             if(parser_result->type->subtype->kind != TYPE_VOID)
-                printf("MOVQ %%rax, %%rdi\n");
+                emit_str("MOVQ %rax, %rdi\n");
             else
-                printf("MOVQ $0,  %%rdi\n");
+                emit_str("MOVQ $0,  %rdi\n");
         }
-        printf("MOVQ $60, %%rax\n");
-        printf("syscall\n");
+        // A raw exit skips the runtime's exit handlers, so flush its output
+        // buffer by hand first.
+        emit_str("PUSHQ %rdi\n");
+        emit_str("CALL printFlush\n");
+        emit_str("POPQ %rdi\n");
+        emit_str("MOVQ $60, %rax\n");
+        emit_str("syscall\n");
+
+        inline_destroy();
+        string_pool_emit();
+        string_pool_destroy();
+        emit_close();
+        stats_phase_end();
 
         scope_exit();
 
-        decl_destroy(&parser_result);
+        if(options.peephole_stats)
+            peephole_report(stderr);
+        if(options.typecheck_stats)
+            expr_typecheck_report(stderr);
+        if(options.stats)
+            stats_report(stderr);
+
+        type_table_destroy();
+        arena_destroy();
+        intern_destroy();
     } 
     else
     {
         fclose(yyin);
         yylex_destroy();
-        decl_destroy(&parser_result);
+        type_table_destroy();
+        arena_destroy();
+        intern_destroy();
+        emit_close();
         return 1;
     }
 
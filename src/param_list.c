@@ -1,16 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
+#include "arena.h"
 #include "param_list.h"
 #include "symbol.h"
 #include "type.h"
 #include "expr.h"
 
-extern int STRMAX;
-
-struct param_list* param_list_create(char* name, struct type* type, struct param_list* next)
+struct param_list* param_list_create(const char* name, struct type* type, struct param_list* next)
 {
-    struct param_list* pParams = malloc(sizeof(struct param_list));
+    struct param_list* pParams = arena_alloc(sizeof(struct param_list));
 
     if(pParams)
     {
@@ -23,33 +21,15 @@ struct param_list* param_list_create(char* name, struct type* type, struct param
     return pParams;
 }
 
-bool param_list_equals(struct param_list* a, struct param_list* b)
-{
-    if(!a && !b) return true;
-    if(!a || !b) return false;
-
-    if(strncmp(a->name, b->name, STRMAX) == 0 && type_equals(a->type, b->type) && param_list_equals(a->next, b->next))
-        return true;
-
-    return false;
-}
-
 struct param_list* param_list_copy(struct param_list* params)
 {
     if(!params) return NULL;
 
-    struct param_list* pParams = malloc(sizeof(struct param_list));
+    struct param_list* pParams = arena_alloc(sizeof(struct param_list));
     if(pParams)
     {
-        pParams->name = malloc(sizeof(char) * STRMAX);
-        if(!pParams->name)
-        {
-            free(pParams);
-            return NULL;
-        }
-
-        strncpy(pParams->name, params->name, STRMAX);
-        pParams->type = type_copy(params->type);
+        pParams->name = params->name;
+        pParams->type = params->type;
         pParams->next = param_list_copy(params->next);
         pParams->symbol = params->symbol;
     }
@@ -59,12 +39,11 @@ struct param_list* param_list_copy(struct param_list* params)
 
 void param_list_resolve(struct param_list* pParams)
 {
-    if(!pParams) return;
-
-    pParams->symbol = symbol_create(SYMBOL_PARAM, pParams->type, pParams->name);
-    scope_bind(pParams->name, pParams->symbol);    
-
-    param_list_resolve(pParams->next);
+    for(; pParams; pParams = pParams->next)
+    {
+        pParams->symbol = symbol_create(SYMBOL_PARAM, pParams->type, pParams->name);
+        scope_bind(pParams->name, pParams->symbol);
+    }
 }
 
 void param_list_typecheck(struct param_list* a, struct param_list* b)
@@ -107,7 +86,6 @@ void param_list_typecheck_call(struct param_list* a, struct expr* b)
         expr_print(b); printf("\n");
     }
 
-    type_destroy(&b_type);
     param_list_typecheck_call(a->next, b->right);
 }
 
@@ -125,20 +103,3 @@ void param_list_print(struct param_list* pParams)
         }
     }
 }
-
-void param_list_destroy(struct param_list** ppParam_list)
-{
-    if(ppParam_list && *ppParam_list)
-    {
-        struct param_list* pParams = *ppParam_list;
-        param_list_destroy(&pParams->next);
-        
-        type_destroy(&pParams->type);
-        symbol_destroy(&pParams->symbol);
-
-        free(pParams->name);
-        free(pParams);
-        *ppParam_list = NULL;
-    }
-}
-
@@ -0,0 +1,530 @@
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+
+// A rule replaces at most this many instructions at once.
+#define PEEPHOLE_WINDOW 4
+// Threading jumps around a cycle of empty blocks never settles, so passes are capped.
+#define PEEPHOLE_PASSES 8
+
+struct peephole
+{
+    struct instr_list* code;
+    // Indexed by label number less label_base, the lowest label in the body.
+    int* labels;
+    int* refs;
+    int label_base;
+    int label_count;
+};
+
+/*
+ * A rule looks at the instructions starting at i. When it matches it writes
+ * their replacement to out and returns how many instructions it consumed.
+ */
+struct peephole_rule
+{
+    const char* name;
+    int (*apply)(struct peephole* p, int i, struct instr* out, int* nOut);
+    int hits;
+};
+
+static int rule_unreachable(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_jump_next(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_jump_over(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_jump_thread(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_unused_label(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_self_move(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_store_load(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_dead_store(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_negate(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_lea(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_increment(struct peephole* p, int i, struct instr* out, int* nOut);
+static int rule_zero_xor(struct peephole* p, int i, struct instr* out, int* nOut);
+
+// Tried in order at every instruction, the first match wins.
+static struct peephole_rule rules[] = {
+    {"unreachable", rule_unreachable, 0},
+    {"jump-next", rule_jump_next, 0},
+    {"jump-over", rule_jump_over, 0},
+    {"jump-thread", rule_jump_thread, 0},
+    {"unused-label", rule_unused_label, 0},
+    {"self-move", rule_self_move, 0},
+    {"store-load", rule_store_load, 0},
+    {"dead-store", rule_dead_store, 0},
+    {"negate", rule_negate, 0},
+    {"lea", rule_lea, 0},
+    {"increment", rule_increment, 0},
+    {"zero-xor", rule_zero_xor, 0},
+};
+static const int rule_count = sizeof(rules) / sizeof(rules[0]);
+
+static struct instr* at(struct peephole* p, int i);
+static bool index_labels(struct peephole* p);
+static int jump_target(struct peephole* p, int label);
+static bool operand_equal(struct operand* a, struct operand* b);
+static bool operand_reads(struct operand* op, int reg);
+static bool flags_live(struct peephole* p, int i);
+static bool writes_flags(instr_t kind);
+static bool reads_flags(instr_t kind);
+
+/*
+ * Rewrites short instruction sequences in an allocated function body into
+ * cheaper equivalents, repeating until no rule matches.
+ */
+void peephole_function(struct instr_list* code)
+{
+    if(!code) return;
+
+    struct peephole p = {code, NULL, NULL, 0, 0};
+    for(int pass = 0; pass < PEEPHOLE_PASSES; pass++)
+    {
+        if(!index_labels(&p))
+            break;
+
+        struct instr_list* out = instr_list_create();
+        bool changed = false;
+        int i = 0;
+        while(i < code->size)
+        {
+            struct instr repl[PEEPHOLE_WINDOW];
+            int nRepl = 0, used = 0;
+            for(int r = 0; r < rule_count && !used; r++)
+            {
+                used = rules[r].apply(&p, i, repl, &nRepl);
+                if(used)
+                    rules[r].hits++;
+            }
+
+            if(!used)
+            {
+                instr_list_append(out, &code->arr[i++]);
+                continue;
+            }
+
+            for(int k = 0; k < nRepl; k++)
+                instr_list_append(out, &repl[k]);
+            i += used;
+            changed = true;
+        }
+
+        free(code->arr);
+        code->arr = out->arr;
+        code->size = out->size;
+        code->capacity = out->capacity;
+
+        out->arr = NULL;
+        out->size = 0;
+        instr_list_destroy(&out);
+
+        if(!changed)
+            break;
+    }
+
+    free(p.labels);
+    free(p.refs);
+}
+
+/*
+ * Prints how often each rule fired over the whole compilation.
+ */
+void peephole_report(FILE* out)
+{
+    for(int r = 0; r < rule_count; r++)
+        fprintf(out, "peephole %-14s %d\n", rules[r].name, rules[r].hits);
+}
+
+/*
+ * Nothing reaches code between an unconditional jump and the next label.
+ */
+static int rule_unreachable(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    struct instr* prev = at(p, i - 1);
+    if(!prev || (prev->kind != INSTR_JMP && prev->kind != INSTR_RET))
+        return 0;
+    if(in->kind == INSTR_LABEL || in->kind == INSTR_DIRECTIVE)
+        return 0;
+
+    *nOut = 0;
+    return 1;
+}
+
+/*
+ * JMP .Lx straight into .Lx: falls through instead.
+ */
+static int rule_jump_next(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    if(!instr_is_jump(in->kind))
+        return 0;
+
+    for(struct instr* next = at(p, ++i); next && next->kind == INSTR_LABEL; next = at(p, ++i))
+    {
+        if(next->dst.value == in->dst.value)
+        {
+            *nOut = 0;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Jcc .La; JMP .Lb; .La: becomes Jncc .Lb; .La:
+ */
+static int rule_jump_over(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    struct instr* jump = at(p, i + 1);
+    struct instr* label = at(p, i + 2);
+    if(!instr_is_jump(in->kind) || in->kind == INSTR_JMP || !jump || jump->kind != INSTR_JMP)
+        return 0;
+    if(!label || label->kind != INSTR_LABEL || label->dst.value != in->dst.value)
+        return 0;
+
+    out[0] = *jump;
+    out[0].kind = instr_jump_negate(in->kind);
+    *nOut = 1;
+    return 2;
+}
+
+/*
+ * A jump to a label whose first instruction is JMP .Ly goes to .Ly directly.
+ */
+static int rule_jump_thread(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    if(!instr_is_jump(in->kind))
+        return 0;
+
+    int target = jump_target(p, in->dst.value);
+    if(target == -1)
+        return 0;
+
+    struct instr* next = at(p, target);
+    if(!next || next->kind != INSTR_JMP || next->dst.value == in->dst.value)
+        return 0;
+
+    out[0] = *in;
+    out[0].dst = next->dst;
+    *nOut = 1;
+    return 1;
+}
+
+static int rule_unused_label(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    if(in->kind != INSTR_LABEL || p->refs[in->dst.value - p->label_base] > 0)
+        return 0;
+
+    *nOut = 0;
+    return 1;
+}
+
+static int rule_self_move(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    if(in->kind != INSTR_MOVQ || !operand_equal(&in->src, &in->dst))
+        return 0;
+
+    *nOut = 0;
+    return 1;
+}
+
+/*
+ * MOVQ a, b; MOVQ b, a: the second move copies back a value a still holds.
+ */
+static int rule_store_load(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    struct instr* next = at(p, i + 1);
+    if(in->kind != INSTR_MOVQ || !next || next->kind != INSTR_MOVQ)
+        return 0;
+    if(!operand_equal(&in->src, &next->dst) || !operand_equal(&in->dst, &next->src))
+        return 0;
+    // A load into a register its own address uses changes where the store goes.
+    if(in->dst.kind == OPERAND_REG && operand_reads(&in->src, in->dst.reg))
+        return 0;
+
+    out[0] = *in;
+    *nOut = 1;
+    return 2;
+}
+
+/*
+ * A register written and then overwritten before anything reads it, or
+ * written just before the epilogue restores or discards it.
+ */
+static int rule_dead_store(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    struct instr* next = at(p, i + 1);
+    if(in->kind != INSTR_MOVQ && in->kind != INSTR_LEAQ && in->kind != INSTR_MOVZBQ)
+        return 0;
+    if(in->dst.kind != OPERAND_REG || in->dst.reg == REG_RSP || in->dst.reg == REG_RBP)
+        return 0;
+
+    int reg = in->dst.reg;
+    bool dead;
+    if(!next || (next->kind == INSTR_JMP && next->dst.value == p->code->epilogue))
+        dead = reg != REG_RAX;
+    else
+        dead = (next->kind == INSTR_MOVQ || next->kind == INSTR_LEAQ) && next->dst.kind == OPERAND_REG &&
+               next->dst.reg == reg && !operand_reads(&next->src, reg);
+
+    if(!dead)
+        return 0;
+
+    *nOut = 0;
+    return 1;
+}
+
+/*
+ * MOVQ $0, r; SUBQ x, r becomes MOVQ x, r; NEGQ r.
+ */
+static int rule_negate(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    struct instr* next = at(p, i + 1);
+    if(in->kind != INSTR_MOVQ || in->src.kind != OPERAND_IMM || in->src.value != 0)
+        return 0;
+    if(!next || next->kind != INSTR_SUBQ || !operand_equal(&in->dst, &next->dst))
+        return 0;
+    if(next->src.kind == OPERAND_MEM && in->dst.kind == OPERAND_MEM)
+        return 0;
+    if(in->dst.kind == OPERAND_REG && operand_reads(&next->src, in->dst.reg))
+        return 0;
+
+    out[0] = *in;
+    out[0].src = next->src;
+    out[1] = *next;
+    out[1].kind = INSTR_NEGQ;
+    out[1].src = operand_none();
+    *nOut = 2;
+    return 2;
+}
+
+/*
+ * MOVQ a, r; ADDQ b, r becomes a single LEAQ when nothing reads the flags
+ * the ADDQ would have set.
+ */
+static int rule_lea(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    struct instr* next = at(p, i + 1);
+    if(in->kind != INSTR_MOVQ || in->src.kind != OPERAND_REG || in->dst.kind != OPERAND_REG)
+        return 0;
+    if(!next || (next->kind != INSTR_ADDQ && next->kind != INSTR_SUBQ) || !operand_equal(&in->dst, &next->dst))
+        return 0;
+
+    int base = in->src.reg;
+    int reg = in->dst.reg;
+    struct operand addr;
+    if(next->src.kind == OPERAND_IMM)
+        addr = operand_mem(base, -1, 0, next->kind == INSTR_ADDQ ? next->src.value : -next->src.value);
+    else if(next->kind == INSTR_ADDQ && next->src.kind == OPERAND_REG && next->src.reg != reg)
+        addr = operand_mem(base, next->src.reg, 1, 0);
+    else
+        return 0;
+
+    if(base == reg || flags_live(p, i + 2))
+        return 0;
+
+    out[0] = *in;
+    out[0].kind = INSTR_LEAQ;
+    out[0].src = addr;
+    *nOut = 1;
+    return 2;
+}
+
+/*
+ * Adding or subtracting one. INCQ and DECQ leave CF alone, which none of
+ * the signed conditions read.
+ */
+static int rule_increment(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    if((in->kind != INSTR_ADDQ && in->kind != INSTR_SUBQ) || in->src.kind != OPERAND_IMM)
+        return 0;
+    if(in->src.value != 1 && in->src.value != -1)
+        return 0;
+
+    bool up = (in->kind == INSTR_ADDQ) == (in->src.value == 1);
+    out[0] = *in;
+    out[0].kind = up ? INSTR_INCQ : INSTR_DECQ;
+    out[0].src = operand_none();
+    *nOut = 1;
+    return 1;
+}
+
+/*
+ * MOVQ $0, r becomes XORQ r, r. XOR clobbers the flags, so this is left
+ * alone between a compare and the instruction that reads its result.
+ */
+static int rule_zero_xor(struct peephole* p, int i, struct instr* out, int* nOut)
+{
+    struct instr* in = at(p, i);
+    if(in->kind != INSTR_MOVQ || in->src.kind != OPERAND_IMM || in->src.value != 0 || in->dst.kind != OPERAND_REG)
+        return 0;
+    if(flags_live(p, i + 1))
+        return 0;
+
+    out[0] = *in;
+    out[0].kind = INSTR_XORQ;
+    out[0].src = in->dst;
+    *nOut = 1;
+    return 1;
+}
+
+static struct instr* at(struct peephole* p, int i)
+{
+    if(i < 0 || i >= p->code->size)
+        return NULL;
+
+    return &p->code->arr[i];
+}
+
+/*
+ * Records where each label sits and how many jumps or addresses refer to it.
+ */
+static bool index_labels(struct peephole* p)
+{
+    // Label numbers run across the whole program, so only this body's span
+    // of them gets a slot.
+    int min = p->code->epilogue, max = p->code->epilogue;
+    for(int i = 0; i < p->code->size; i++)
+    {
+        struct instr* in = &p->code->arr[i];
+        if(in->kind == INSTR_LABEL || instr_is_jump(in->kind))
+        {
+            min = in->dst.value < min ? in->dst.value : min;
+            max = in->dst.value > max ? in->dst.value : max;
+        }
+    }
+
+    p->label_base = min;
+    if(max - min + 1 > p->label_count)
+    {
+        free(p->labels);
+        free(p->refs);
+        p->label_count = max - min + 1;
+        p->labels = malloc(sizeof(int) * p->label_count);
+        p->refs = malloc(sizeof(int) * p->label_count);
+        if(!p->labels || !p->refs)
+        {
+            fprintf(stderr, "index_labels - Failed to allocate space for labels\n");
+            return false;
+        }
+    }
+
+    for(int l = 0; l < p->label_count; l++)
+    {
+        p->labels[l] = -1;
+        p->refs[l] = 0;
+    }
+
+    for(int i = 0; i < p->code->size; i++)
+    {
+        struct instr* in = &p->code->arr[i];
+        if(in->kind == INSTR_LABEL)
+            p->labels[in->dst.value - min] = i;
+        else if(instr_is_jump(in->kind))
+            p->refs[in->dst.value - min]++;
+
+        // .L labels addressed through %rip are data, never part of the body.
+        struct operand* ops[2] = {&in->src, &in->dst};
+        for(int k = 0; k < 2; k++)
+            if(ops[k]->kind == OPERAND_MEM && ops[k]->reg == REG_RIP && !ops[k]->symbol &&
+               ops[k]->value >= min && ops[k]->value - min < p->label_count)
+                p->refs[ops[k]->value - min]++;
+    }
+
+    return true;
+}
+
+/*
+ * Index of the first instruction executed after jumping to label, or -1
+ * when the label is outside this list.
+ */
+static int jump_target(struct peephole* p, int label)
+{
+    label -= p->label_base;
+    if(label < 0 || label >= p->label_count || p->labels[label] == -1)
+        return -1;
+
+    int i = p->labels[label];
+    while(i < p->code->size && p->code->arr[i].kind == INSTR_LABEL)
+        i++;
+
+    return i < p->code->size ? i : -1;
+}
+
+static bool operand_equal(struct operand* a, struct operand* b)
+{
+    if(a->kind != b->kind || a->reg != b->reg || a->index != b->index || a->scale != b->scale || a->value != b->value)
+        return false;
+
+    if(!a->symbol || !b->symbol)
+        return a->symbol == b->symbol;
+
+    return strcmp(a->symbol, b->symbol) == 0;
+}
+
+static bool operand_reads(struct operand* op, int reg)
+{
+    if(op->kind == OPERAND_REG)
+        return op->reg == reg;
+    if(op->kind == OPERAND_MEM)
+        return op->reg == reg || op->index == reg;
+
+    return false;
+}
+
+/*
+ * Whether an instruction from i onwards reads the flags before they are
+ * set again. Selection never carries flags across a label, jump or call.
+ */
+static bool flags_live(struct peephole* p, int i)
+{
+    for(struct instr* in = at(p, i); in; in = at(p, ++i))
+    {
+        if(reads_flags(in->kind))
+            return true;
+        if(writes_flags(in->kind) || in->kind == INSTR_LABEL || in->kind == INSTR_JMP ||
+           in->kind == INSTR_CALL || in->kind == INSTR_RET)
+            return false;
+    }
+
+    return false;
+}
+
+static bool writes_flags(instr_t kind)
+{
+    switch(kind)
+    {
+        case INSTR_ADDQ:
+        case INSTR_SUBQ:
+        case INSTR_IMULQ:
+        case INSTR_IMULQ_WIDE:
+        case INSTR_IDIVQ:
+        case INSTR_XORQ:
+        case INSTR_ANDQ:
+        case INSTR_SHLQ:
+        case INSTR_SARQ:
+        case INSTR_SHRQ:
+        case INSTR_TESTQ:
+        case INSTR_CMPQ:
+        case INSTR_INCQ:
+        case INSTR_DECQ:
+        case INSTR_NEGQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool reads_flags(instr_t kind)
+{
+    return (instr_is_jump(kind) && kind != INSTR_JMP) || (kind >= INSTR_SETE && kind <= INSTR_CMOVGE);
+}
@@ -1,51 +1,792 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include "register.h"
+#include "instr.h"
+#include "stats.h"
 
-extern int STRMAX;
-extern struct scratch regs[];
+/*
+ * A set of virtual registers kept as an unordered list. Most registers live
+ * for a few instructions, so per block lists stay short where a bit per
+ * register in every block would grow with the square of the function.
+ */
+struct live_set
+{
+    int size;
+    int capacity;
+    int* arr;
+};
+
+struct block
+{
+    int first;
+    int last;
+    int succ[2];
+    struct live_set use;
+    struct live_set def;
+    struct live_set in;
+};
+
+struct interval
+{
+    int vreg;
+    int start;
+    int end;
+};
 
 static int label_num = 0;
 
-int scratch_alloc(struct scratch regs[])
+// Allocation order: callee saved registers first, they are saved once per function.
+static const int alloc_regs[] = {REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15, REG_R10, REG_R11};
+static const int alloc_count = sizeof(alloc_regs) / sizeof(alloc_regs[0]);
+
+// Leaf functions make no calls, so the argument registers that are not also
+// rewrite scratch cost nothing to use and go before the callee saved ones.
+static const int leaf_regs[] = {REG_RDI, REG_RSI, REG_R8, REG_R9, REG_R10, REG_R11,
+                                REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15};
+static const int leaf_count = sizeof(leaf_regs) / sizeof(leaf_regs[0]);
+
+/*
+ * The registers linear scan hands out. In a leaf, reserved[r] is where an
+ * incoming argument is last read from r, and only the range it is copied
+ * into (hint[v] == r) may take r before then.
+ */
+struct reg_pool
+{
+    const int* regs;
+    int count;
+    int reserved[REG_COUNT];
+    int* hint;
+};
+
+static int build_blocks(struct instr_list* code, struct block** pBlocks);
+static void compute_liveness(struct instr_list* code, struct block* blocks, int nBlocks, int nv);
+static void live_add(struct live_set* set, int v);
+static void extend(struct interval* intervals, int v, int position);
+static void instr_regs(struct instr* in, int uses[], int* nUses, int defs[], int* nDefs);
+static void leaf_pool(struct instr_list* code, struct reg_pool* pool);
+static void linear_scan(struct interval* intervals, int count, int* location, struct reg_pool* pool);
+static int free_register(struct reg_pool* pool, struct interval* cur, bool* inUse);
+static int compare_start(const void* a, const void* b);
+static bool* unneeded_saves(struct instr_list* code, struct interval* intervals, int count, int* location);
+static bool is_call_save(struct instr* in);
+static void rewrite(struct instr_list* code, int* location, int frameSlots, bool* drop);
+static struct operand rewrite_operand(struct instr_list* out, struct operand op, int* location, int frameSlots);
+
+bool register_is_virtual(int r)
+{
+    return r >= VREG_BASE;
+}
+
+const char* register_name(int r)
+{
+    static const char* names[] = {"%rax", "%rbx", "%rcx", "%rdx", "%rsi", "%rdi", "%rbp", "%rsp",
+                                  "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15", "%rip"};
+    static char vbuf[32];
+
+    if(r >= 0 && r < REG_COUNT)
+        return names[r];
+
+    snprintf(vbuf, sizeof(vbuf), "%%v%d", r - VREG_BASE);
+    return vbuf;
+}
+
+/*
+ * The low byte of a register, as written by SETcc.
+ */
+const char* register_name8(int r)
+{
+    static const char* names[] = {"%al", "%bl", "%cl", "%dl", "%sil", "%dil", "%bpl", "%spl",
+                                  "%r8b", "%r9b", "%r10b", "%r11b", "%r12b", "%r13b", "%r14b", "%r15b", "%rip"};
+    static char vbuf[32];
+
+    if(r >= 0 && r < REG_COUNT)
+        return names[r];
+
+    snprintf(vbuf, sizeof(vbuf), "%%v%db", r - VREG_BASE);
+    return vbuf;
+}
+
+/*
+ * Linear scan register allocation (Poletto & Sarkar) over the virtual
+ * registers in a function body. Live ranges come from block level liveness
+ * so locals stay in one register across loops and statements; when more
+ * ranges overlap than there are registers the one ending furthest away is
+ * spilled to a stack slot below the function's local slots. A leaf body,
+ * one without calls, also gets the argument registers and keeps each
+ * argument where it arrived when it can.
+ *
+ * Returns the number of 8 byte frame slots the function needs.
+ */
+int register_allocate(struct instr_list* code, int frameSlots, bool leaf)
+{
+    if(!code) return frameSlots;
+
+    int nv = code->vreg_count;
+
+    struct block* blocks = NULL;
+    int nBlocks = build_blocks(code, &blocks);
+    compute_liveness(code, blocks, nBlocks, nv);
+
+    struct interval* intervals = malloc(sizeof(struct interval) * (nv ? nv : 1));
+    int* location = malloc(sizeof(int) * (nv ? nv : 1));
+    if(!intervals || !location)
+    {
+        fprintf(stderr, "register_allocate - Failed to allocate space for live intervals\n");
+        free(intervals);
+        free(location);
+        return frameSlots;
+    }
+
+    for(int v = 0; v < nv; v++)
+    {
+        intervals[v].vreg = v;
+        intervals[v].start = INT_MAX;
+        intervals[v].end = -1;
+    }
+
+    // Live out of a block is live into one of its successors.
+    for(int b = 0; b < nBlocks; b++)
+    {
+        for(int j = 0; j < blocks[b].in.size; j++)
+            extend(intervals, blocks[b].in.arr[j], blocks[b].first);
+
+        for(int s = 0; s < 2; s++)
+            if(blocks[b].succ[s] != -1)
+                for(int j = 0; j < blocks[blocks[b].succ[s]].in.size; j++)
+                    extend(intervals, blocks[blocks[b].succ[s]].in.arr[j], blocks[b].last);
+    }
+
+    for(int i = 0; i < code->size; i++)
+    {
+        int uses[4], defs[2], nUses = 0, nDefs = 0;
+        instr_regs(&code->arr[i], uses, &nUses, defs, &nDefs);
+
+        for(int j = 0; j < nUses + nDefs; j++)
+            extend(intervals, (j < nUses ? uses[j] : defs[j - nUses]) - VREG_BASE, i);
+    }
+
+    int count = 0;
+    for(int v = 0; v < nv; v++)
+        if(intervals[v].end != -1)
+            intervals[count++] = intervals[v];
+
+    qsort(intervals, count, sizeof(struct interval), compare_start);
+
+    for(int v = 0; v < nv; v++)
+        location[v] = -1;
+
+    struct reg_pool pool = {alloc_regs, alloc_count, {0}, NULL};
+    for(int r = 0; r < REG_COUNT; r++)
+        pool.reserved[r] = -1;
+    if(leaf)
+        leaf_pool(code, &pool);
+
+    linear_scan(intervals, count, location, &pool);
+    free(pool.hint);
+
+    int spills = 0;
+    for(int v = 0; v < nv; v++)
+        if(location[v] < -1)
+            spills = spills > -location[v] - 1 ? spills : -location[v] - 1;
+
+    bool* drop = unneeded_saves(code, intervals, count, location);
+    rewrite(code, location, frameSlots, drop);
+
+    for(int b = 0; b < nBlocks; b++)
+    {
+        free(blocks[b].use.arr);
+        free(blocks[b].def.arr);
+        free(blocks[b].in.arr);
+    }
+    free(blocks);
+    free(intervals);
+    free(location);
+    free(drop);
+
+    return frameSlots + spills;
+}
+
+/*
+ * The callee saved registers an allocated body writes, in the order the
+ * prologue pushes them. regs needs room for five; returns how many there are.
+ */
+int register_callee_saved(struct instr_list* code, int regs[])
 {
-    for(int i = 0; i < 7; i++)
+    static const int saved[] = {REG_RBX, REG_R12, REG_R13, REG_R14, REG_R15};
+    bool used[REG_COUNT + 1] = {false};
+
+    for(int i = 0; code && i < code->size; i++)
     {
-        if(!regs[i].in_use)
+        struct operand* ops[2] = {&code->arr[i].src, &code->arr[i].dst};
+        for(int j = 0; j < 2; j++)
         {
-            regs[i].in_use = true;
-            return i;
+            if(ops[j]->kind != OPERAND_REG && ops[j]->kind != OPERAND_MEM)
+                continue;
+
+            if(ops[j]->reg >= 0 && ops[j]->reg < REG_COUNT)
+                used[ops[j]->reg] = true;
+            if(ops[j]->kind == OPERAND_MEM && ops[j]->index >= 0 && ops[j]->index < REG_COUNT)
+                used[ops[j]->index] = true;
         }
     }
 
+    int count = 0;
+    for(int i = 0; i < (int)(sizeof(saved) / sizeof(saved[0])); i++)
+        if(used[saved[i]])
+            regs[count++] = saved[i];
+
+    return count;
+}
+
+int label_create()
+{
+    stats.labels++;
+    return label_num++;
+}
+
+static int build_blocks(struct instr_list* code, struct block** pBlocks)
+{
+    int minLabel = INT_MAX, maxLabel = -1;
+    int nBlocks = 0;
+
+    for(int i = 0; i < code->size; i++)
+    {
+        struct instr* in = &code->arr[i];
+        if(in->kind == INSTR_LABEL)
+        {
+            if(in->dst.value < minLabel) minLabel = in->dst.value;
+            if(in->dst.value > maxLabel) maxLabel = in->dst.value;
+        }
+
+        bool leader = i == 0 || in->kind == INSTR_LABEL || instr_is_jump(code->arr[i - 1].kind) ||
+                      code->arr[i - 1].kind == INSTR_RET;
+        if(leader)
+            nBlocks++;
+    }
+
+    int* labelBlock = NULL;
+    if(maxLabel >= 0)
+        labelBlock = malloc(sizeof(int) * (maxLabel - minLabel + 1));
+
+    struct block* blocks = calloc(nBlocks ? nBlocks : 1, sizeof(struct block));
+    int b = -1;
+    for(int i = 0; i < code->size; i++)
+    {
+        struct instr* in = &code->arr[i];
+        bool leader = i == 0 || in->kind == INSTR_LABEL || instr_is_jump(code->arr[i - 1].kind) ||
+                      code->arr[i - 1].kind == INSTR_RET;
+        if(leader)
+        {
+            b++;
+            blocks[b].first = i;
+        }
+
+        blocks[b].last = i;
+        if(in->kind == INSTR_LABEL)
+            labelBlock[in->dst.value - minLabel] = b;
+    }
+
+    for(b = 0; b < nBlocks; b++)
+    {
+        struct instr* in = &code->arr[blocks[b].last];
+        blocks[b].succ[0] = -1;
+        blocks[b].succ[1] = -1;
+
+        if(instr_is_jump(in->kind))
+        {
+            if(in->dst.value >= minLabel && in->dst.value <= maxLabel)
+                blocks[b].succ[0] = labelBlock[in->dst.value - minLabel];
+            if(in->kind != INSTR_JMP && b + 1 < nBlocks)
+                blocks[b].succ[1] = b + 1;
+        }
+        else if(in->kind != INSTR_RET && b + 1 < nBlocks)
+            blocks[b].succ[0] = b + 1;
+    }
+
+    free(labelBlock);
+    *pBlocks = blocks;
+    return nBlocks;
+}
+
+/*
+ * Backward liveness to a fixed point. Each pass visits the blocks last to
+ * first, so a body without loops settles in one pass and a second confirms
+ * it. Live in sets only grow, so a block changed when its set got bigger.
+ * mark and added are stamped with a fresh number for each set built, which
+ * saves clearing them.
+ */
+static void compute_liveness(struct instr_list* code, struct block* blocks, int nBlocks, int nv)
+{
+    int* mark = malloc(sizeof(int) * (nv ? nv : 1));
+    int* added = malloc(sizeof(int) * (nv ? nv : 1));
+    if(!mark || !added)
+    {
+        fprintf(stderr, "compute_liveness - Failed to allocate space for live sets\n");
+        free(mark);
+        free(added);
+        return;
+    }
+
+    for(int v = 0; v < nv; v++)
+    {
+        mark[v] = -1;
+        added[v] = -1;
+    }
+
+    for(int b = 0; b < nBlocks; b++)
+    {
+        for(int i = blocks[b].first; i <= blocks[b].last; i++)
+        {
+            int uses[4], defs[2], nUses = 0, nDefs = 0;
+            instr_regs(&code->arr[i], uses, &nUses, defs, &nDefs);
+
+            // mark holds the block's defs so far, added its uses.
+            for(int j = 0; j < nUses; j++)
+            {
+                int v = uses[j] - VREG_BASE;
+                if(mark[v] != b && added[v] != b)
+                {
+                    added[v] = b;
+                    live_add(&blocks[b].use, v);
+                }
+            }
+
+            for(int j = 0; j < nDefs; j++)
+            {
+                int v = defs[j] - VREG_BASE;
+                if(mark[v] != b)
+                {
+                    mark[v] = b;
+                    live_add(&blocks[b].def, v);
+                }
+            }
+        }
+    }
+
+    struct live_set next = {0, 0, NULL};
+    int stamp = nBlocks;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int b = nBlocks - 1; b >= 0; b--, stamp++)
+        {
+            // in = use | (out - def), where out is the union of the successors' in.
+            next.size = 0;
+            for(int j = 0; j < blocks[b].def.size; j++)
+                mark[blocks[b].def.arr[j]] = stamp;
+
+            for(int j = 0; j < blocks[b].use.size; j++)
+            {
+                added[blocks[b].use.arr[j]] = stamp;
+                live_add(&next, blocks[b].use.arr[j]);
+            }
+
+            for(int s = 0; s < 2; s++)
+            {
+                if(blocks[b].succ[s] == -1)
+                    continue;
+
+                struct live_set* in = &blocks[blocks[b].succ[s]].in;
+                for(int j = 0; j < in->size; j++)
+                {
+                    int v = in->arr[j];
+                    if(mark[v] != stamp && added[v] != stamp)
+                    {
+                        added[v] = stamp;
+                        live_add(&next, v);
+                    }
+                }
+            }
+
+            if(next.size != blocks[b].in.size)
+            {
+                struct live_set old = blocks[b].in;
+                blocks[b].in = next;
+                next = old;
+                changed = true;
+            }
+        }
+    }
+
+    free(next.arr);
+    free(mark);
+    free(added);
+}
+
+static void live_add(struct live_set* set, int v)
+{
+    if(set->size >= set->capacity)
+    {
+        int capacity = set->capacity ? set->capacity * 2 : 4;
+        int* temp = realloc(set->arr, sizeof(int) * capacity);
+        if(!temp)
+        {
+            fprintf(stderr, "live_add - Failed to grow live set\n");
+            return;
+        }
+
+        set->arr = temp;
+        set->capacity = capacity;
+    }
+
+    set->arr[set->size++] = v;
+}
+
+static void extend(struct interval* intervals, int v, int position)
+{
+    if(position < intervals[v].start) intervals[v].start = position;
+    if(position > intervals[v].end) intervals[v].end = position;
+}
+
+/*
+ * Collects the virtual registers an instruction reads and writes. Physical
+ * registers are never allocated so they are left out.
+ */
+static void instr_regs(struct instr* in, int uses[], int* nUses, int defs[], int* nDefs)
+{
+    struct operand* ops[2] = {&in->src, &in->dst};
+    for(int i = 0; i < 2; i++)
+    {
+        struct operand* op = ops[i];
+        if(op->kind == OPERAND_MEM)
+        {
+            if(register_is_virtual(op->reg)) uses[(*nUses)++] = op->reg;
+            if(register_is_virtual(op->index)) uses[(*nUses)++] = op->index;
+        }
+        else if(op->kind == OPERAND_REG && register_is_virtual(op->reg))
+        {
+            if(op == &in->src)
+            {
+                uses[(*nUses)++] = op->reg;
+                continue;
+            }
+
+            switch(in->kind)
+            {
+                case INSTR_MOVQ:
+                case INSTR_MOVZBQ:
+                case INSTR_LEAQ:
+                case INSTR_POPQ:
+                case INSTR_SETE:
+                case INSTR_SETNE:
+                case INSTR_SETL:
+                case INSTR_SETLE:
+                case INSTR_SETG:
+                case INSTR_SETGE:
+                    defs[(*nDefs)++] = op->reg;
+                    break;
+                case INSTR_CMOVE:
+                case INSTR_CMOVNE:
+                case INSTR_CMOVL:
+                case INSTR_CMOVLE:
+                case INSTR_CMOVG:
+                case INSTR_CMOVGE:
+                case INSTR_ADDQ:
+                case INSTR_SUBQ:
+                case INSTR_IMULQ:
+                case INSTR_XORQ:
+                case INSTR_ANDQ:
+                case INSTR_SHLQ:
+                case INSTR_SARQ:
+                case INSTR_SHRQ:
+                case INSTR_INCQ:
+                case INSTR_DECQ:
+                case INSTR_NEGQ:
+                    uses[(*nUses)++] = op->reg;
+                    defs[(*nDefs)++] = op->reg;
+                    break;
+                default:
+                    uses[(*nUses)++] = op->reg;
+                    break;
+            }
+        }
+    }
+}
+
+/*
+ * Switches pool to the leaf registers. Selection copies each argument out of
+ * its register with a MOVQ at the top of the body, and nothing else in a
+ * leaf touches those registers, so the copy is hinted to stay put.
+ */
+static void leaf_pool(struct instr_list* code, struct reg_pool* pool)
+{
+    pool->hint = malloc(sizeof(int) * (code->vreg_count ? code->vreg_count : 1));
+    if(!pool->hint)
+    {
+        fprintf(stderr, "leaf_pool - Failed to allocate space for register hints\n");
+        return;
+    }
+
+    pool->regs = leaf_regs;
+    pool->count = leaf_count;
+    for(int v = 0; v < code->vreg_count; v++)
+        pool->hint[v] = -1;
+
+    for(int i = 0; i < code->size; i++)
+    {
+        struct instr* in = &code->arr[i];
+        if(in->kind != INSTR_MOVQ || in->src.kind != OPERAND_REG || register_is_virtual(in->src.reg) ||
+           in->dst.kind != OPERAND_REG || !register_is_virtual(in->dst.reg))
+            continue;
+
+        for(int r = 0; r < leaf_count; r++)
+        {
+            if(leaf_regs[r] == in->src.reg)
+            {
+                pool->hint[in->dst.reg - VREG_BASE] = in->src.reg;
+                pool->reserved[in->src.reg] = i;
+            }
+        }
+    }
+}
+
+static void linear_scan(struct interval* intervals, int count, int* location, struct reg_pool* pool)
+{
+    struct interval** active = malloc(sizeof(struct interval*) * (pool->count + 1));
+    bool inUse[REG_COUNT] = {false};
+    int nActive = 0, nSpills = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        struct interval* cur = &intervals[i];
+
+        // Expire ranges that ended before this one starts. active is sorted by end.
+        int kept = 0;
+        for(int j = 0; j < nActive; j++)
+        {
+            if(active[j]->end < cur->start)
+                inUse[location[active[j]->vreg]] = false;
+            else
+                active[kept++] = active[j];
+        }
+        nActive = kept;
+
+        if(nActive == pool->count)
+        {
+            struct interval* last = active[nActive - 1];
+            if(last->end > cur->end)
+            {
+                location[cur->vreg] = location[last->vreg];
+                location[last->vreg] = -2 - nSpills++;
+                nActive--;
+            }
+            else
+            {
+                location[cur->vreg] = -2 - nSpills++;
+                continue;
+            }
+        }
+        else
+        {
+            // Registers still holding an argument may leave nothing free.
+            int r = free_register(pool, cur, inUse);
+            if(r == -1)
+            {
+                location[cur->vreg] = -2 - nSpills++;
+                continue;
+            }
+
+            location[cur->vreg] = r;
+            inUse[r] = true;
+        }
+
+        int j = nActive;
+        while(j > 0 && active[j - 1]->end > cur->end)
+        {
+            active[j] = active[j - 1];
+            j--;
+        }
+        active[j] = cur;
+        nActive++;
+    }
+
+    free(active);
+}
+
+static int free_register(struct reg_pool* pool, struct interval* cur, bool* inUse)
+{
+    int hint = pool->hint ? pool->hint[cur->vreg] : -1;
+    if(hint != -1 && !inUse[hint])
+        return hint;
+
+    for(int r = 0; r < pool->count; r++)
+        if(!inUse[pool->regs[r]] && cur->start > pool->reserved[pool->regs[r]])
+            return pool->regs[r];
+
     return -1;
 }
 
-void scratch_free(struct scratch regs[], int r)
+static int compare_start(const void* a, const void* b)
 {
-    if(r < 0 || r > 6) return;
+    const struct interval* x = a;
+    const struct interval* y = b;
+    if(x->start != y->start)
+        return x->start - y->start;
 
-    regs[r].in_use = false;
+    return x->vreg - y->vreg;
 }
 
-const char* scratch_name(struct scratch regs[], int r)
+/*
+ * isel_call saves %r10 and %r11 around every call since it runs before
+ * allocation. Marks the pushes and pops of calls that nothing allocated to
+ * those two is live across, so rewrite can drop them. Both go or stay
+ * together to keep %rsp 16 byte aligned.
+ */
+static bool* unneeded_saves(struct instr_list* code, struct interval* intervals, int count, int* location)
 {
-    if(r < 0 || r > 6) return NULL;
+    int* live = calloc(code->size + 1, sizeof(int));
+    bool* drop = calloc(code->size + 1, sizeof(bool));
+    if(!live || !drop)
+    {
+        fprintf(stderr, "unneeded_saves - Failed to allocate space for call saves\n");
+        free(live);
+        free(drop);
+        return NULL;
+    }
+
+    // Counts ranges in %r10 or %r11 that start before and end after each point.
+    for(int i = 0; i < count; i++)
+    {
+        int r = location[intervals[i].vreg];
+        if((r == REG_R10 || r == REG_R11) && intervals[i].start + 1 < intervals[i].end)
+        {
+            live[intervals[i].start + 1]++;
+            live[intervals[i].end]--;
+        }
+    }
+
+    int across = 0;
+    for(int i = 0; i < code->size; i++)
+    {
+        across += live[i];
+        if(code->arr[i].kind != INSTR_CALL || across > 0)
+            continue;
 
-    return regs[r].name;
+        for(int j = i - 1; j >= 0 && !drop[j]; j--)
+        {
+            if(is_call_save(&code->arr[j]))
+            {
+                drop[j] = true;
+                if(code->arr[j].dst.reg == REG_R10)
+                    break;
+            }
+        }
+        for(int j = i + 1; j < code->size; j++)
+        {
+            if(is_call_save(&code->arr[j]))
+            {
+                drop[j] = true;
+                if(code->arr[j].dst.reg == REG_R10)
+                    break;
+            }
+        }
+    }
+
+    free(live);
+    return drop;
 }
 
-int label_create()
+// Before rewriting, physical %r10 and %r11 only appear in call saves.
+static bool is_call_save(struct instr* in)
 {
-    return label_num++;
+    return (in->kind == INSTR_PUSHQ || in->kind == INSTR_POPQ) && in->dst.kind == OPERAND_REG &&
+           (in->dst.reg == REG_R10 || in->dst.reg == REG_R11);
 }
 
-char* label_name(int label)
+/*
+ * Replaces virtual registers with their locations. Spilled registers become
+ * -N(%rbp) operands; where x86 needs a register instead (memory to memory
+ * moves, address components, IMULQ/LEAQ/MOVZBQ/CMOVcc destinations) the value goes
+ * through %rax, %rcx or %rdx, which are never allocated.
+ */
+static void rewrite(struct instr_list* code, int* location, int frameSlots, bool* drop)
 {
-    char* label_buf = malloc(sizeof(char) * STRMAX);
-    if(label_buf)
-        snprintf(label_buf, STRMAX, ".L%d", label);
+    struct instr_list* out = instr_list_create();
+    out->vreg_count = code->vreg_count;
+
+    for(int i = 0; i < code->size; i++)
+    {
+        if(drop && drop[i])
+            continue;
+
+        struct instr in = code->arr[i];
+        bool isCmov = in.kind >= INSTR_CMOVE && in.kind <= INSTR_CMOVGE;
+        bool needsRegDst = in.kind == INSTR_IMULQ || in.kind == INSTR_LEAQ || in.kind == INSTR_MOVZBQ || isCmov;
+        bool dstInMemory = in.dst.kind == OPERAND_MEM ||
+                           (in.dst.kind == OPERAND_REG && register_is_virtual(in.dst.reg) && location[in.dst.reg - VREG_BASE] < 0);
+
+        // A memory source is read into %rdx before the destination is
+        // rewritten, since a spilled base or index in either address is
+        // loaded into the same %rax/%rcx.
+        in.src = rewrite_operand(out, in.src, location, frameSlots);
+        if(!needsRegDst && in.src.kind == OPERAND_MEM && dstInMemory)
+        {
+            instr_emit(out, INSTR_MOVQ, in.src, operand_reg(REG_RDX));
+            in.src = operand_reg(REG_RDX);
+        }
+        in.dst = rewrite_operand(out, in.dst, location, frameSlots);
+
+        if(needsRegDst && in.dst.kind == OPERAND_MEM)
+        {
+            struct operand spill = in.dst;
+            if(in.kind == INSTR_IMULQ || isCmov)
+                instr_emit(out, INSTR_MOVQ, spill, operand_reg(REG_RDX));
 
-    return label_buf;
+            in.dst = operand_reg(REG_RDX);
+            instr_list_append(out, &in);
+            instr_emit(out, INSTR_MOVQ, operand_reg(REG_RDX), spill);
+            continue;
+        }
+
+        instr_list_append(out, &in);
+    }
+
+    free(code->arr);
+    code->arr = out->arr;
+    code->size = out->size;
+    code->capacity = out->capacity;
+
+    out->arr = NULL;
+    out->size = 0;
+    instr_list_destroy(&out);
 }
 
+static struct operand rewrite_operand(struct instr_list* out, struct operand op, int* location, int frameSlots)
+{
+    if(op.kind == OPERAND_REG && register_is_virtual(op.reg))
+    {
+        int loc = location[op.reg - VREG_BASE];
+        if(loc >= 0)
+        {
+            op.reg = loc;
+            return op;
+        }
+
+        return operand_mem(REG_RBP, -1, 0, -(frameSlots - loc - 1) * 8);
+    }
+
+    if(op.kind == OPERAND_MEM)
+    {
+        int* parts[2] = {&op.reg, &op.index};
+        int scratch[2] = {REG_RAX, REG_RCX};
+        for(int i = 0; i < 2; i++)
+        {
+            if(!register_is_virtual(*parts[i]))
+                continue;
+
+            int loc = location[*parts[i] - VREG_BASE];
+            if(loc >= 0)
+                *parts[i] = loc;
+            else
+            {
+                instr_emit(out, INSTR_MOVQ, operand_mem(REG_RBP, -1, 0, -(frameSlots - loc - 1) * 8), operand_reg(scratch[i]));
+                *parts[i] = scratch[i];
+            }
+        }
+    }
+
+    return op;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <time.h>
+#include "stats.h"
+
+#define STATS_PHASES 8
+
+struct stats stats;
+
+struct sample
+{
+    double wall;
+    double cpu;
+    long heap;
+    struct stats counts;
+};
+
+struct phase
+{
+    const char* name;
+    struct sample begin;
+    struct sample end;
+    long peak_rss;
+};
+
+static struct phase phases[STATS_PHASES];
+static int phase_count;
+
+static struct sample sample(void);
+static double seconds(clockid_t clock);
+static long heap_in_use(void);
+static long peak_rss(void);
+static void print_phase(FILE* out, const char* name, struct sample* begin, struct sample* end, long rss);
+
+void stats_phase_begin(const char* name)
+{
+    if(phase_count == STATS_PHASES)
+    {
+        fprintf(stderr, "stats_phase_begin - Too many phases\n");
+        return;
+    }
+
+    phases[phase_count].name = name;
+    phases[phase_count].begin = sample();
+}
+
+void stats_phase_end(void)
+{
+    if(phase_count == STATS_PHASES) return;
+
+    phases[phase_count].end = sample();
+    phases[phase_count].peak_rss = peak_rss();
+    phase_count++;
+}
+
+/*
+ * Writes every finished phase, and their sum as "total", as one JSON object.
+ * Times are in milliseconds and peak RSS in KiB. The counts are what each
+ * phase added; allocations are those made from the arena and the identifier
+ * pool, and heap_bytes is how much the malloc heap grew (or shrank) on top.
+ */
+void stats_report(FILE* out)
+{
+    fprintf(out, "{\n  \"phases\": [\n");
+    for(int i = 0; i < phase_count; i++)
+    {
+        fprintf(out, "    ");
+        print_phase(out, phases[i].name, &phases[i].begin, &phases[i].end, phases[i].peak_rss);
+        fprintf(out, i + 1 < phase_count ? ",\n" : "\n");
+    }
+    fprintf(out, "  ],\n  \"total\": ");
+
+    if(phase_count)
+        print_phase(out, "total", &phases[0].begin, &phases[phase_count - 1].end, peak_rss());
+    else
+        fprintf(out, "null");
+    fprintf(out, "\n}\n");
+}
+
+static struct sample sample(void)
+{
+    struct sample s = {seconds(CLOCK_MONOTONIC), seconds(CLOCK_PROCESS_CPUTIME_ID), heap_in_use(), stats};
+    return s;
+}
+
+static double seconds(clockid_t clock)
+{
+    struct timespec ts;
+    if(clock_gettime(clock, &ts) != 0)
+        return 0;
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Bytes handed out by malloc and not yet freed, where libc can tell us.
+static long heap_in_use(void)
+{
+#ifdef __GLIBC__
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+static long peak_rss(void)
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    return usage.ru_maxrss;
+}
+
+static void print_phase(FILE* out, const char* name, struct sample* begin, struct sample* end, long rss)
+{
+    fprintf(out, "{\"name\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"peak_rss_kb\": %ld, "
+                 "\"allocations\": %ld, \"allocated_bytes\": %ld, \"heap_bytes\": %ld, \"ast_nodes\": %ld, \"symbols\": %ld, "
+                 "\"labels\": %ld, \"instructions\": %ld}",
+            name, (end->wall - begin->wall) * 1000, (end->cpu - begin->cpu) * 1000, rss,
+            end->counts.allocations - begin->counts.allocations,
+            end->counts.allocated_bytes - begin->counts.allocated_bytes,
+            end->heap - begin->heap,
+            end->counts.ast_nodes - begin->counts.ast_nodes,
+            end->counts.symbols - begin->counts.symbols,
+            end->counts.labels - begin->counts.labels,
+            end->counts.instructions - begin->counts.instructions);
+}
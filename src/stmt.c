@@ -1,18 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "arena.h"
 #include "expr.h"
+#include "ir.h"
+#include "stats.h"
 #include "stmt.h"
 #include "decl.h"
 #include "type.h"
 
+static void print_codegen(struct expr* list, struct decl* pDecl, struct ir_func* func);
+static int  print_text(struct expr* item, char* text);
+static void print_call(struct ir_func* func, char* format, int length, int* values, int count);
 static void print_tab(void);
 
 struct stmt* stmt_create(stmt_t kind, struct decl* decl, struct expr* init_expr, struct expr* expr,
                 struct expr* next_expr, struct stmt* body, struct stmt* else_body, struct stmt* next)
 {
-    struct stmt* pStmt = malloc(sizeof(struct stmt));
+    struct stmt* pStmt = arena_alloc(sizeof(struct stmt));
     if(pStmt)
     {
+        stats.ast_nodes++;
         pStmt->kind = kind;
         pStmt->decl = decl;
         pStmt->init_expr = init_expr;
@@ -28,244 +36,188 @@ struct stmt* stmt_create(stmt_t kind, struct decl* decl, struct expr* init_expr,
 
 void stmt_resolve(struct stmt* pStmt)
 {
-    if(!pStmt) return;
-
-    decl_resolve(pStmt->decl);
+    for(; pStmt; pStmt = pStmt->next)
+    {
+        decl_resolve(pStmt->decl);
 
-    expr_resolve(pStmt->init_expr);
-    expr_resolve(pStmt->expr);
-    expr_resolve(pStmt->next_expr);
+        expr_resolve(pStmt->init_expr);
+        expr_resolve(pStmt->expr);
+        expr_resolve(pStmt->next_expr);
 
-    if(pStmt->body)
-    {
-        scope_enter();
-        stmt_resolve(pStmt->body);
-        scope_exit();
-    }
-    if(pStmt->else_body)
-    {
-        scope_enter();
-        stmt_resolve(pStmt->else_body);
-        scope_exit();
+        if(pStmt->body)
+        {
+            scope_enter();
+            stmt_resolve(pStmt->body);
+            scope_exit();
+        }
+        if(pStmt->else_body)
+        {
+            scope_enter();
+            stmt_resolve(pStmt->else_body);
+            scope_exit();
+        }
     }
-
-    stmt_resolve(pStmt->next);
 }
 
 void stmt_typecheck(struct stmt* pStmt, struct symbol* symbol)
 {
-    if(!pStmt) return;
-
-    struct type* type = NULL;
-    switch(pStmt->kind)
+    for(; pStmt; pStmt = pStmt->next)
     {
-        case STMT_DECL:
-            decl_typecheck(pStmt->decl);
-            break;
-        case STMT_EXPR:
-            type = expr_typecheck(pStmt->expr);
-            type_destroy(&type);
-            break;
-        case STMT_IF_ELSE:
-            type = expr_typecheck(pStmt->expr);
-            if(!type || type->kind != TYPE_BOOL)
-            {
-                printf("type error: if statement requires a boolean condition (");
-                expr_print(pStmt->expr); printf(")\n");
-            }
-            type_destroy(&type);
-
-            break;
-        case STMT_FOR:
-            type = expr_typecheck(pStmt->expr);
-            if(type && type->kind != TYPE_BOOL)
-            {
-                printf("type error: for statement requires a boolean conditional expression (");
-                expr_print(pStmt->expr); printf(")\n");
-            }
-            type_destroy(&type);
-
-            break;
-        case STMT_PRINT:
-            type = expr_typecheck(pStmt->expr);
-
-            if(type && (type->kind == TYPE_FUNCTION || type->kind == TYPE_ARRAY))
-            {
-                printf("type error: print statements must be a list of atomic types (");
-                expr_print(pStmt->expr); printf(")\n");
-            }
-
-            type_destroy(&type);
-            break;
-        case STMT_RETURN:
-            type = expr_typecheck(pStmt->expr);
-            if(type && (type->kind == TYPE_FUNCTION || type->kind == TYPE_ARRAY))
-            {
-                printf("type error: functions must return an atomic type or void\n");
-                expr_print(pStmt->expr); printf("\n");
-            }
-
-            if(!symbol)
-            {
-                fprintf(stderr, "type error: no return type to compare against\n");
-            }
-            else if((!type_equals(type, symbol->type->subtype)))
-            {
-                printf("type error: mismatched return type in function %s. Expected type (", symbol->name);
-                type_print(symbol->type->subtype); printf("), Actual type (");
-                type_print(type); printf(")\n");
-                printf("  - return "); expr_print(pStmt->expr); printf(";\n");
-            }
-
-            type_destroy(&type);
-            break;
-        case STMT_BLOCK:
-            stmt_typecheck(pStmt->body, symbol);
-            break;
-        default:
-            printf("error: invalid statement kind\n");
-            stmt_print(pStmt, 0);
-            break;
-    }
+        struct type* type = NULL;
+        switch(pStmt->kind)
+        {
+            case STMT_DECL:
+                decl_typecheck(pStmt->decl);
+                break;
+            case STMT_EXPR:
+                expr_typecheck(pStmt->expr);
+                break;
+            case STMT_IF_ELSE:
+                type = expr_typecheck(pStmt->expr);
+                if(!type || type->kind != TYPE_BOOL)
+                {
+                    printf("type error: if statement requires a boolean condition (");
+                    expr_print(pStmt->expr); printf(")\n");
+                }
+
+                stmt_typecheck(pStmt->body, symbol);
+                stmt_typecheck(pStmt->else_body, symbol);
+                break;
+            case STMT_FOR:
+                expr_typecheck(pStmt->init_expr);
+                type = expr_typecheck(pStmt->expr);
+                if(type && type->kind != TYPE_BOOL)
+                {
+                    printf("type error: for statement requires a boolean conditional expression (");
+                    expr_print(pStmt->expr); printf(")\n");
+                }
+                expr_typecheck(pStmt->next_expr);
+
+                stmt_typecheck(pStmt->body, symbol);
+                break;
+            case STMT_PRINT:
+                type = expr_typecheck(pStmt->expr);
+
+                if(type && (type->kind == TYPE_FUNCTION || type->kind == TYPE_ARRAY))
+                {
+                    printf("type error: print statements must be a list of atomic types (");
+                    expr_print(pStmt->expr); printf(")\n");
+                }
+                break;
+            case STMT_RETURN:
+                type = expr_typecheck(pStmt->expr);
+                if(type && (type->kind == TYPE_FUNCTION || type->kind == TYPE_ARRAY))
+                {
+                    printf("type error: functions must return an atomic type or void\n");
+                    expr_print(pStmt->expr); printf("\n");
+                }
 
-    stmt_typecheck(pStmt->next, symbol);
+                if(!symbol)
+                {
+                    fprintf(stderr, "type error: no return type to compare against\n");
+                }
+                else if((!type_equals(type, symbol->type->subtype)))
+                {
+                    printf("type error: mismatched return type in function %s. Expected type (", symbol->name);
+                    type_print(symbol->type->subtype); printf("), Actual type (");
+                    type_print(type); printf(")\n");
+                    printf("  - return "); expr_print(pStmt->expr); printf(";\n");
+                }
+                break;
+            case STMT_BLOCK:
+                stmt_typecheck(pStmt->body, symbol);
+                break;
+            default:
+                printf("error: invalid statement kind\n");
+                stmt_print(pStmt, 0);
+                break;
+        }
+    }
 }
 
-void stmt_codegen(struct stmt *pStmt, struct decl* pDecl, struct scratch regs[], struct symbol* sym)
+void stmt_codegen(struct stmt *pStmt, struct decl* pDecl, struct ir_func* func, struct symbol* sym)
 {
-    if(!pStmt) return;
+    for(; pStmt; pStmt = pStmt->next)
+    {
+        int thenBlock, elseBlock = -1, doneBlock, topBlock;
 
-    char *falseLabel, *doneLabel, *topLabel;
-    struct type* type = NULL;
+        switch(pStmt->kind)
+        {
+            case STMT_DECL:
+                decl_codegen(pStmt->decl, func);
+                break;
+            case STMT_EXPR:
+                expr_codegen(pStmt->expr, pDecl, func, 0, false);
+                break;
+            case STMT_IF_ELSE:
+                thenBlock = ir_block_create(func);
+                if(pStmt->else_body)
+                    elseBlock = ir_block_create(func);
+                doneBlock = ir_block_create(func);
+                expr_codegen_branch(pStmt->expr, pDecl, func, thenBlock, pStmt->else_body ? elseBlock : doneBlock);
 
-    switch(pStmt->kind)
-    {
-        case STMT_DECL:
-            decl_codegen(pStmt->decl, regs);
-            break;
-        case STMT_EXPR:
-            expr_codegen(pStmt->expr, pDecl, regs, 0, NULL);
-            scratch_free(regs, pStmt->expr->reg);
-            break;
-        case STMT_IF_ELSE:
-            falseLabel = label_name(label_create());
-            doneLabel = label_name(label_create());
-
-            expr_codegen(pStmt->expr, pDecl, regs, 0, NULL);
-            printf("CMPQ $0, %s\n", scratch_name(regs, pStmt->expr->reg));
-            scratch_free(regs, pStmt->expr->reg);
-            
-            printf("JE %s\n", falseLabel);
-            stmt_codegen(pStmt->body, pDecl, regs, sym);
-            printf("JMP %s\n", doneLabel);
-
-            printf("%s:\n", falseLabel);
-            stmt_codegen(pStmt->else_body, pDecl, regs, sym);
-            printf("%s:\n", doneLabel);
-
-            free(falseLabel);
-            free(doneLabel);
-            break;
-        case STMT_FOR:
-            topLabel = label_name(label_create());
-            doneLabel = label_name(label_create());
-
-            if(pStmt->init_expr)
-                expr_codegen(pStmt->init_expr, pDecl, regs, 0, NULL);
-
-            printf("%s:\n", topLabel);
-            if(pStmt->expr)
-            {
-                expr_codegen(pStmt->expr, pDecl, regs, 0, NULL);
-                printf("CMPQ $0, %s\n", scratch_name(regs, pStmt->expr->reg));
-                printf("JE %s\n", doneLabel);
-            }
-
-            stmt_codegen(pStmt->body, pDecl, regs, sym);
-
-            if(pStmt->next_expr)
-                expr_codegen(pStmt->next_expr, pDecl, regs, 0, NULL);
-
-            printf("JMP %s\n", topLabel);
-            printf("%s:\n", doneLabel);
-
-            if(pStmt->init_expr)
-                scratch_free(regs, pStmt->init_expr->reg);
-            if(pStmt->expr)
-                scratch_free(regs, pStmt->expr->reg);
-            if(pStmt->next_expr)
-                scratch_free(regs, pStmt->next_expr->reg);
-
-            free(topLabel);
-            free(doneLabel);
-            break;
-        case STMT_PRINT:
-            if(pStmt->expr)
-            {
-                struct expr* e = pStmt->expr;
-                while(e)
+                ir_block_set(func, thenBlock);
+                stmt_codegen(pStmt->body, pDecl, func, sym);
+                ir_jump(func, doneBlock);
+
+                if(pStmt->else_body)
                 {
-                    expr_codegen(e->left, pDecl, regs, 0, NULL);
-                    e->reg = e->left->reg;
-                    type = expr_typecheck(e);
-
-                    printf("PUSHQ %%r10\n");
-                    printf("PUSHQ %%r11\n");
-
-                    switch(type->kind)
-                    {
-                        case TYPE_BOOL:
-                            printf("MOVQ %s, %%rdi\n", scratch_name(regs, e->reg));
-                            printf("CALL printBool\n");
-                            break;
-                        case TYPE_CHAR:
-                            printf("MOVQ %s, %%rdi\n", scratch_name(regs, e->reg));
-                            printf("CALL printChar\n");
-                            break;
-                        case TYPE_INTEGER:
-                            printf("MOVQ %s, %%rdi\n", scratch_name(regs, e->reg));
-                            printf("CALL printInt\n");
-                            break;
-                        case TYPE_STRING:
-                            printf("MOVQ %s, %%rdi\n", scratch_name(regs, e->reg));
-                            printf("CALL printString\n");
-                            break;
-                        default:
-                            printf("[ERROR] - Non printable type passed to print %s\n", type_string(type));
-                            break;
-                    }
-
-                    printf("POPQ %%r11\n");
-                    printf("POPQ %%r10\n");
-
-                    scratch_free(regs, e->reg);
-                    e = e->right;
-               }
-            }
-            break;
-        case STMT_RETURN:
-            expr_codegen(pStmt->expr, pDecl, regs, 0, NULL);
-            if(pDecl->type->subtype->kind != TYPE_VOID)
-                printf("MOVQ %s, %%rax\n", scratch_name(regs, pStmt->expr->reg));
-            printf("JMP .%s_epilouge\n", pDecl->name);
-            scratch_free(regs, pStmt->expr->reg);
-            break;
-        case STMT_BLOCK:
-            stmt_codegen(pStmt->body, pDecl, regs, sym);
-            break;
-        default:
-            printf("error: invalid statement kind\n");
-            stmt_print(pStmt, 0);
-            break;
-    }
+                    ir_block_set(func, elseBlock);
+                    stmt_codegen(pStmt->else_body, pDecl, func, sym);
+                    ir_jump(func, doneBlock);
+                }
+
+                ir_block_set(func, doneBlock);
+                break;
+            case STMT_FOR:
+                if(pStmt->init_expr)
+                    expr_codegen(pStmt->init_expr, pDecl, func, 0, false);
+
+                topBlock = ir_block_create(func);
+                thenBlock = ir_block_create(func);
+                doneBlock = ir_block_create(func);
+                ir_jump(func, topBlock);
+
+                ir_block_set(func, topBlock);
+                if(pStmt->expr)
+                    expr_codegen_branch(pStmt->expr, pDecl, func, thenBlock, doneBlock);
+                else
+                    ir_jump(func, thenBlock);
 
-    stmt_codegen(pStmt->next, pDecl, regs, sym);
+                ir_block_set(func, thenBlock);
+                stmt_codegen(pStmt->body, pDecl, func, sym);
+
+                if(pStmt->next_expr)
+                    expr_codegen(pStmt->next_expr, pDecl, func, 0, false);
+
+                ir_jump(func, topBlock);
+                ir_block_set(func, doneBlock);
+                break;
+            case STMT_PRINT:
+                print_codegen(pStmt->expr, pDecl, func);
+                break;
+            case STMT_RETURN:
+                expr_codegen(pStmt->expr, pDecl, func, 0, false);
+                if(pStmt->expr && pDecl->type->subtype->kind != TYPE_VOID)
+                    ir_emit(func, IR_RET, -1, ir_temp_value(pStmt->expr->reg), ir_none());
+                else
+                    ir_emit(func, IR_RET, -1, ir_none(), ir_none());
+                break;
+            case STMT_BLOCK:
+                stmt_codegen(pStmt->body, pDecl, func, sym);
+                break;
+            default:
+                printf("error: invalid statement kind\n");
+                stmt_print(pStmt, 0);
+                break;
+        }
+    }
 }
 
 void stmt_print(struct stmt* pStmt, int depth)
 {
-    if(pStmt)
-    { 
+    for(; pStmt; pStmt = pStmt->next)
+    {
         switch(pStmt->kind)
         {
             case STMT_DECL:
@@ -347,32 +299,147 @@ void stmt_print(struct stmt* pStmt, int depth)
         }
 
         printf("\n");
-        stmt_print(pStmt->next, depth);
     }
 }
 
-void stmt_destroy(struct stmt** ppStmt)
+/*
+ * Prints the whole list with as few printList calls as possible. String and
+ * char literals are copied into the format text, and every other item adds
+ * a %d, %c, %b or %s directive with its value passed after the format. An
+ * item that calls a function first prints what came before it, so output
+ * from inside the call still appears in the same place.
+ */
+static void print_codegen(struct expr* list, struct decl* pDecl, struct ir_func* func)
+{
+    // A literal adds at most twice its length, with every '%' doubled, and
+    // anything else one two character directive and one value.
+    int capacity = 1;
+    int items = 0;
+    for(struct expr* e = list; e; e = e->right)
+    {
+        struct expr* item = e->left;
+        capacity += item->kind == EXPR_STRING_LITERAL ? 2 * strlen(item->string_literal) : 2;
+        items++;
+    }
+
+    char* format = malloc(capacity);
+    int* values = malloc(sizeof(int) * (items + 1));
+    if(!format || !values)
+    {
+        fprintf(stderr, "print_codegen - Failed to allocate space for print format\n");
+        free(format);
+        free(values);
+        return;
+    }
+
+    int length = 0;
+    int count = 0;
+
+    for(struct expr* e = list; e; e = e->right)
+    {
+        struct expr* item = e->left;
+        int textLength = print_text(item, format + length);
+
+        if(textLength >= 0)
+        {
+            length += textLength;
+            continue;
+        }
+
+        if(expr_has_call(item))
+        {
+            print_call(func, format, length, values, count);
+            length = 0;
+            count = 0;
+        }
+
+        expr_codegen(item, pDecl, func, 0, false);
+        e->reg = item->reg;
+
+        switch(e->type->kind)
+        {
+            case TYPE_BOOL:
+                memcpy(format + length, "%b", 2);
+                break;
+            case TYPE_CHAR:
+                memcpy(format + length, "%c", 2);
+                break;
+            case TYPE_INTEGER:
+                memcpy(format + length, "%d", 2);
+                break;
+            case TYPE_STRING:
+                memcpy(format + length, "%s", 2);
+                break;
+            default:
+                printf("[ERROR] - Non printable type passed to print %s\n", type_string(e->type));
+                continue;
+        }
+        length += 2;
+        values[count++] = item->reg;
+    }
+
+    print_call(func, format, length, values, count);
+    free(format);
+    free(values);
+}
+
+/*
+ * Writes a string or char literal as format text, with '%' doubled, and
+ * returns its length. Anything else, or a literal that cannot be part of a
+ * format, gives -1 and is printed through a directive.
+ */
+static int print_text(struct expr* item, char* text)
 {
-    if(ppStmt && *ppStmt)
+    char c = item->integer_value;
+    const char* s = &c;
+    int n = 1;
+
+    if(item->kind == EXPR_STRING_LITERAL)
     {
-        struct stmt* pStmt = *ppStmt;
-        decl_destroy(&pStmt->decl);
-        
-        expr_destroy(&pStmt->init_expr);
-        expr_destroy(&pStmt->expr);
-        expr_destroy(&pStmt->next_expr);
-
-        stmt_destroy(&pStmt->body);
-        stmt_destroy(&pStmt->else_body);
-        stmt_destroy(&pStmt->next);
-
-        free(pStmt);
-        *ppStmt = NULL;
+        s = item->string_literal;
+        n = strlen(s);
     }
+    else if(item->kind != EXPR_CHAR_LITERAL)
+        return -1;
+
+    int length = 0;
+    for(int i = 0; i < n; i++)
+    {
+        if(s[i] == '\0')
+            return -1;
+
+        text[length++] = s[i];
+        if(s[i] == '%')
+            text[length++] = '%';
+    }
+
+    return length;
+}
+
+// printList(format, values...) for whatever has been gathered so far.
+static void print_call(struct ir_func* func, char* format, int length, int* values, int count)
+{
+    if(length == 0) return;
+
+    char* copy = arena_alloc(length + 1);
+    if(!copy)
+    {
+        fprintf(stderr, "print_call - Failed to allocate space for print format\n");
+        return;
+    }
+    memcpy(copy, format, length);
+
+    int reg = ir_temp(func);
+    ir_emit(func, IR_STRING, reg, ir_none(), ir_none())->name = copy;
+
+    ir_emit(func, IR_ARG, -1, ir_temp_value(reg), ir_none());
+    for(int i = 0; i < count; i++)
+        ir_emit(func, IR_ARG, -1, ir_temp_value(values[i]), ir_none());
+
+    ir_emit(func, IR_CALL, -1, ir_imm(count + 1), ir_none())->name = "printList";
 }
 
 static void print_tab(void)
 {
     printf("    ");
 }
-
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "string_pool.h"
+#include "emit.h"
+#include "expr.h"
+#include "hash_table.h"
+#include "register.h"
+
+struct pool_entry
+{
+    char* literal;
+    int label;
+};
+
+static bool entry_equal(void* a, void* b);
+static void entry_destroy(void** item);
+
+// Literals in the order they were first used, and the same entries by content.
+static Vector* pool_entries;
+static struct hash_table* pool_index;
+
+/*
+ * The .L label of a string literal's bytes. Every use of the same content
+ * shares one copy, emitted to .rodata by string_pool_emit.
+ */
+int string_pool_label(const char* literal)
+{
+    if(!pool_entries)
+    {
+        pool_entries = vectorInit(entry_equal, entry_destroy);
+        pool_index = hash_table_create();
+    }
+
+    struct pool_entry* entry = hash_table_at(pool_index, literal);
+    if(entry)
+        return entry->label;
+
+    entry = malloc(sizeof(struct pool_entry));
+    if(!entry || !(entry->literal = malloc(strlen(literal) + 1)))
+    {
+        fprintf(stderr, "string_pool_label - Failed to allocate space for literal\n");
+        free(entry);
+        return label_create();
+    }
+
+    strcpy(entry->literal, literal);
+    entry->label = label_create();
+    vectorInsert(pool_entries, entry);
+    hash_table_insert(pool_index, entry->literal, entry);
+
+    return entry->label;
+}
+
+/*
+ * Writes every pooled literal once. Called after all code so the section
+ * switch happens a single time at the end of the file.
+ */
+void string_pool_emit(void)
+{
+    if(!pool_entries || pool_entries->size == 0) return;
+
+    emit_str(".section .rodata\n");
+    for(int i = 0; i < pool_entries->size; i++)
+    {
+        struct pool_entry* entry = vectorAt(pool_entries, i);
+        char* buffer = malloc(2 * strlen(entry->literal) + 1);
+        if(!buffer)
+        {
+            fprintf(stderr, "string_pool_emit - Failed to allocate space for literal\n");
+            continue;
+        }
+
+        unclean_string(entry->literal, buffer);
+        emit_label(entry->label);
+        emit_str(": .string \"");
+        emit_str(buffer);
+        emit_str("\"\n");
+        free(buffer);
+    }
+}
+
+void string_pool_destroy(void)
+{
+    vectorDestroy(&pool_entries);
+    hash_table_destroy(&pool_index);
+}
+
+static bool entry_equal(void* a, void* b)
+{
+    return strcmp(((struct pool_entry*)a)->literal, ((struct pool_entry*)b)->literal) == 0;
+}
+
+static void entry_destroy(void** item)
+{
+    if(item && *item)
+    {
+        struct pool_entry* entry = *item;
+        free(entry->literal);
+        free(entry);
+        *item = NULL;
+    }
+}
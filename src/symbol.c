@@ -1,28 +1,54 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
+#include "arena.h"
 #include "symbol.h"
 #include "hash_table.h"
 #include "stack.h"
+#include "stats.h"
 #include "type.h"
 #include "expr.h"
+#include "ir.h"
+
+/*
+ * Every name in scope lives in one table, keyed by name, whose value is the
+ * chain of bindings for that name with the innermost on top. Each scope on
+ * the stack keeps the list of bindings it made so they can be unwound when
+ * it exits.
+ */
+struct binding
+{
+    struct symbol* symbol;
+    int level;
+    struct chain* chain;
+    struct binding* shadowed;
+    struct binding* next;
+};
+
+struct chain
+{
+    struct binding* top;
+};
+
+struct scope
+{
+    struct binding* bindings;
+};
 
-extern int STRMAX;
-stack* scope_stack = NULL;
+static stack* scope_stack = NULL;
+static struct hash_table* symbol_table = NULL;
 
-struct symbol* symbol_create(symbol_t kind, struct type* type, char* name)
+struct symbol* symbol_create(symbol_t kind, struct type* type, const char* name)
 {
     static int local_var_count = 0;
-    struct symbol* sym = malloc(sizeof(struct symbol));
+    struct symbol* sym = arena_alloc(sizeof(struct symbol));
     if(sym)
     {
+        stats.symbols++;
         sym->kind = kind;
-        sym->type = type_copy(type);
+        sym->type = type;
         if(sym->type->kind == TYPE_AUTO)
         {
-            struct type* temp = expr_typecheck(sym->type->value);
-            type_destroy(&sym->type);
-            sym->type = temp;
+            sym->type = expr_typecheck(sym->type->value);
         }
 
         if(sym->kind == SYMBOL_GLOBAL)
@@ -44,51 +70,45 @@ struct symbol* symbol_create(symbol_t kind, struct type* type, char* name)
                 sym->which = local_var_count++;
         }
 
-        sym->name = malloc(sizeof(char) * STRMAX);
-        if(!sym->name)
-        {
-            free(sym);
-            return NULL;
-        }
-
-        strncpy(sym->name, name, STRMAX);
+        sym->name = name;
+        sym->calls = 0;
     }
 
     return sym;
 }
 
-const char* symbol_codegen(struct symbol* symbol)
+/*
+ * Reads the symbol into a fresh temp. Globals are loaded from memory, scalar
+ * params and locals are copied out of their own temp and arrays evaluate to
+ * the address of their first element.
+ */
+int symbol_codegen(struct symbol* symbol, struct ir_func* func)
 {
-    if(!symbol) { return NULL; }
-    char* buf = malloc(sizeof(char) * STRMAX);
-    if(!buf) { return NULL; }
- 
-    if(symbol->kind == SYMBOL_GLOBAL)
-        snprintf(buf, STRMAX, "%s(%%rip)", symbol->name);
+    if(!symbol) { return -1; }
+
+    int temp = ir_temp(func);
+    if(symbol->type->kind == TYPE_ARRAY && symbol->kind != SYMBOL_PARAM)
+        ir_emit(func, IR_ADDR, temp, ir_none(), ir_none())->symbol = symbol;
+    else if(symbol->kind == SYMBOL_GLOBAL)
+        ir_emit(func, IR_LOAD, temp, ir_none(), ir_none())->symbol = symbol;
     else
-        snprintf(buf, STRMAX, "-%d(%%rbp)", (symbol->which + 1) * 8);
+        ir_emit(func, IR_COPY, temp, ir_temp_value(ir_local(func, symbol->which)), ir_none());
 
-    return buf;
+    return temp;
 }
 
 struct symbol* symbol_copy(struct symbol* symbol)
 {
     if(!symbol) return NULL;
 
-    struct symbol* sym = malloc(sizeof(struct symbol)); 
+    struct symbol* sym = arena_alloc(sizeof(struct symbol)); 
     if(sym)
     {
-        sym->name = malloc(sizeof(char) * STRMAX);
-        if(!sym->name)
-        {
-            free(sym);
-            return NULL;
-        }
-
-        strncpy(sym->name, symbol->name, STRMAX);
+        sym->name = symbol->name;
         sym->kind = symbol->kind;
-        sym->type = type_copy(symbol->type);
+        sym->type = symbol->type;
         sym->which = symbol->which;
+        sym->calls = symbol->calls;
     }
 
     return sym;
@@ -99,7 +119,7 @@ bool symbol_equal(struct symbol* a, struct symbol* b)
     if(!a && !b) return true;
     if((a && !b) || (!a && b)) return false;
 
-    if(a->kind == b->kind && type_equals(a->type, b->type) && strncmp(a->name, b->name, STRMAX) == 0 && a->which == b->which)
+    if(a->kind == b->kind && type_equals(a->type, b->type) && a->name == b->name && a->which == b->which)
         return true;
 
     return false;
@@ -108,20 +128,48 @@ bool symbol_equal(struct symbol* a, struct symbol* b)
 void scope_enter(void)
 {
     if(!scope_stack)
+    {
         scope_stack = stack_create();
+        symbol_table = hash_table_create();
+    }
 
-    struct hash_table* table = hash_table_create();
+    struct scope* scope = malloc(sizeof(struct scope));
+    if(!scope)
+    {
+        fprintf(stderr, "scope_enter - Failed to allocate space for scope\n");
+        return;
+    }
 
-    stack_push(scope_stack, (void*)table);
+    scope->bindings = NULL;
+    stack_push(scope_stack, (void*)scope);
 }
 
+/*
+ * Unwinds every binding made in the innermost scope, putting back whatever
+ * each one shadowed. The chains themselves stay in the table until the
+ * outermost scope goes, so a name bound again later reuses its chain.
+ */
 void scope_exit(void)
 {
-    struct hash_table* table = (struct hash_table*)stack_pop(scope_stack);
-    hash_table_destroy(&table);
+    struct scope* scope = (struct scope*)stack_pop(scope_stack);
+    if(!scope) return;
+
+    struct binding* b = scope->bindings;
+    while(b)
+    {
+        struct binding* next = b->next;
+        b->chain->top = b->shadowed;
+        free(b);
+        b = next;
+    }
+    free(scope);
 
     if(stack_size(scope_stack) == 0)
     {
+        for(int i = 0; i < symbol_table->capacity; i++)
+            free(symbol_table->slots[i].value);
+
+        hash_table_destroy(&symbol_table);
         stack_destroy(&scope_stack);
         scope_stack = NULL;
     }
@@ -135,54 +183,64 @@ int scope_level(void)
 void scope_bind(const char* name, struct symbol* sym)
 {
     struct symbol* temp = scope_lookup_current(name);
-    if(temp && strncmp(temp->name, sym->name, STRMAX) == 0 && !symbol_equal(sym, temp))
+    if(temp && temp->name == sym->name && !symbol_equal(sym, temp))
         return;
 
-    int index = stack_size(scope_stack) - 1;
-    hash_table_insert(stack_item(scope_stack, index), name, (void*)sym);
+    struct chain* chain = hash_table_at(symbol_table, name);
+    if(!chain)
+    {
+        chain = malloc(sizeof(struct chain));
+        if(!chain)
+        {
+            fprintf(stderr, "scope_bind - Failed to allocate space for shadow chain\n");
+            return;
+        }
+
+        chain->top = NULL;
+        if(!hash_table_insert(symbol_table, name, chain))
+        {
+            free(chain);
+            return;
+        }
+    }
+
+    struct binding* b = malloc(sizeof(struct binding));
+    if(!b)
+    {
+        fprintf(stderr, "scope_bind - Failed to allocate space for binding\n");
+        return;
+    }
+
+    struct scope* scope = stack_item(scope_stack, stack_size(scope_stack) - 1);
+    b->symbol = sym;
+    b->level = scope_level();
+    b->chain = chain;
+    b->shadowed = chain->top;
+    b->next = scope->bindings;
+    chain->top = b;
+    scope->bindings = b;
 }
 
 struct symbol* scope_lookup(const char* name)
 {
-    if(!name) return NULL;
-
-    for(int i = stack_size(scope_stack) - 1; i >= 0; i--)
-    {
-        struct hash_table* ht = (struct hash_table*)stack_item(scope_stack, i);
-        if(!ht || !ht->arr)
-            continue;
+    if(!name || !symbol_table) return NULL;
 
-        for(int j = 0; j < ht->capacity; j++)
-        {
-            if(!ht->arr[j] || !ht->arr[j]->key)
-                continue;
+    struct chain* chain = hash_table_at(symbol_table, name);
+    if(!chain || !chain->top)
+        return NULL;
 
-            if(strncmp(name, ht->arr[j]->key, STRMAX) == 0)
-                return (struct symbol*)ht->arr[j]->value;
-        }
-    }
-    return NULL;
+    return chain->top->symbol;
 }
 
 struct symbol* scope_lookup_current(const char* name)
 {
-    if(!name) return NULL;
+    if(!name || !symbol_table) return NULL;
 
-    int index = stack_size(scope_stack) - 1;
+    struct chain* chain = hash_table_at(symbol_table, name);
+    if(!chain || !chain->top || chain->top->level != scope_level())
+        return NULL;
 
-    struct hash_table* ht = (struct hash_table*)stack_item(scope_stack, index);
-    if(ht && ht->arr)
-    {
-        for(int i = 0; i < ht->capacity; i++)
-        {
-            if(!ht->arr[i] || !ht->arr[i]->key)
-                continue;
-
-            if(strncmp(name, ht->arr[i]->key, STRMAX) == 0)
-                return (struct symbol*)ht->arr[i]->value;
-        }
-    }
-    return NULL; 
+    return chain->top->symbol;
 }
 
 void symbol_print(struct symbol* sym)
@@ -207,17 +265,3 @@ void symbol_print(struct symbol* sym)
 
     type_print(sym->type);
 }
-
-void symbol_destroy(struct symbol** sym)
-{
-    if(sym && *sym)
-    {
-        struct symbol* symbol = *sym;
-
-        type_destroy(&symbol->type);
-        free(symbol->name);
-        free(symbol);
-        *sym = NULL;
-    }
-}
-
@@ -1,75 +1,96 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "arena.h"
 #include "type.h"
 #include "param_list.h"
 #include "expr.h"
-
+#include "hash_table.h"
+
+/*
+ * Types are hash consed: every distinct type exists once, so they are
+ * compared by pointer and shared freely without copying or freeing.
+ * Primitive kinds are singletons. Arrays are keyed on their element type
+ * and size, and functions on their return type and each param's name and
+ * type. Those children are canonical themselves, so their addresses make
+ * up the key.
+ */
+static struct type primitives[TYPE_VOID + 1];
+static struct hash_table* type_table;
+
+static struct type* type_intern(const char* key, type_t kind, struct type* subtype, struct param_list* params, struct expr* value);
+
+/*
+ * The canonical type with the given shape. params and value are kept by
+ * the first type of their shape and must not change afterwards.
+ */
 struct type* type_create(type_t kind, struct type* subtype, struct param_list* params, struct expr* value)
 {
-    struct type* pType = malloc(sizeof(struct type));
-    
-    if(pType)
+    char buffer[128];
+
+    if(kind == TYPE_ARRAY)
     {
-        pType->kind = kind;
-        pType->subtype = subtype;
-        pType->params = params;
-        pType->value = value;
+        snprintf(buffer, sizeof(buffer), "a%p:%d", (void*)subtype, value ? value->integer_value : -1);
+        return type_intern(buffer, kind, subtype, params, value);
     }
 
-    return pType;
-}
-
-bool type_equals(struct type* a, struct type* b)
-{
-    if(!a || !b) return false;
-
-    if(a->kind == b->kind)
+    if(kind == TYPE_FUNCTION)
     {
-        if(a->kind == TYPE_ARRAY)
-        {
-            if(!a->value && !b->value)
-                return type_equals(a->subtype, b->subtype);
+        // A pointer prints as at most 18 characters.
+        int length = 20;
+        for(struct param_list* p = params; p; p = p->next)
+            length += 40;
 
-            if(!a->value || !b->value)
-                return false;
-
-            return type_equals(a->subtype, b->subtype) && a->value->integer_value == b->value->integer_value;
+        char* key = length > (int)sizeof(buffer) ? malloc(length) : buffer;
+        if(!key)
+        {
+            fprintf(stderr, "type_create - Failed to allocate space for type key\n");
+            return NULL;
         }
 
-        if(a->kind == TYPE_FUNCTION)
-            return type_equals(a->subtype, b->subtype) && param_list_equals(a->params, b->params);
+        int used = snprintf(key, length, "f%p", (void*)subtype);
+        for(struct param_list* p = params; p; p = p->next)
+            used += snprintf(key + used, length - used, "(%p:%p)", (void*)p->name, (void*)p->type);
 
-        return true;
+        struct type* type = type_intern(key, kind, subtype, params, value);
+        if(key != buffer)
+            free(key);
+        return type;
     }
 
-    return false;
+    struct type* type = &primitives[kind];
+    type->kind = kind;
+    return type;
 }
 
-struct type* type_copy(struct type* type)
+/*
+ * The canonical array of size elements. The size expression is only built
+ * the first time the type is seen.
+ */
+struct type* type_array(struct type* subtype, int size)
 {
-    if(!type) return NULL;
+    char key[64];
+    snprintf(key, sizeof(key), "a%p:%d", (void*)subtype, size);
 
-    struct type* pType = malloc(sizeof(struct type));
-    
-    if(pType)
-    {
-        pType->kind = type->kind;
-        pType->subtype = type_copy(type->subtype);
-        pType->params = param_list_copy(type->params);
-        pType->value = expr_copy(type->value);
-    }
+    struct type* type = type_table ? hash_table_at(type_table, key) : NULL;
+    if(type)
+        return type;
+
+    bool was = arena_permanent(true);
+    type = type_intern(key, TYPE_ARRAY, subtype, NULL, expr_create_integer_literal(size));
+    arena_permanent(was);
 
-    return pType;
+    return type;
 }
 
-void type_resolve(struct type* pType)
+bool type_equals(struct type* a, struct type* b)
 {
-    if(!pType) return;
+    return a && a == b;
+}
 
-    type_resolve(pType->subtype);
-    param_list_resolve(pType->params);
-    expr_resolve(pType->value);
+void type_table_destroy(void)
+{
+    hash_table_destroy(&type_table);
 }
 
 void type_print(struct type* pType)
@@ -139,18 +160,30 @@ const char* type_string(struct type* pType)
     }
 }
 
-void type_destroy(struct type** ppType)
+static struct type* type_intern(const char* key, type_t kind, struct type* subtype, struct param_list* params, struct expr* value)
 {
-    if(ppType && *ppType)
-    {
-        struct type* pType = *ppType;
-
-        type_destroy(&pType->subtype);
-        param_list_destroy(&pType->params);
-        expr_destroy(&pType->value);
-
-        free(pType);
-        *ppType = NULL;
-    }
+    if(!type_table)
+        type_table = hash_table_create();
+
+    struct type* type = hash_table_at(type_table, key);
+    if(type)
+        return type;
+
+    // Types live for the whole unit, past any function's sub-arena.
+    bool was = arena_permanent(true);
+    type = arena_alloc(sizeof(struct type));
+    char* copy = arena_alloc(strlen(key) + 1);
+    arena_permanent(was);
+    if(!type || !copy)
+        return NULL;
+
+    type->kind = kind;
+    type->subtype = subtype;
+    type->params = params;
+    type->value = value;
+
+    strcpy(copy, key);
+    hash_table_insert(type_table, copy, type);
+
+    return type;
 }
-
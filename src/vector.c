@@ -29,7 +29,7 @@ bool vectorInsert(Vector* pVector, void* data)
 
     if(pVector->size >= pVector->capacity)
     {
-        void** temp = realloc(pVector->arr, pVector->capacity * 2);
+        void** temp = realloc(pVector->arr, sizeof(void*) * pVector->capacity * 2);
         if(temp == NULL) return false;
 
         pVector->arr = temp;